@@ -6,12 +6,15 @@ struct block_buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
+struct vmaops;
 
 // bio.c
 void            binit(void);
@@ -38,6 +41,11 @@ int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
 
+// futex.c
+void            futexinit(void);
+int             futex_wait(uint64, uint);
+int             futex_wake(uint64, int);
+
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
@@ -58,6 +66,7 @@ void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
 int 						diskleft();
+void            fslogsb(int);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -67,13 +76,15 @@ void            ramdiskrw(struct block_buf*);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
 void            kinit(void);
 int 						kmemleft();
 void            inc_page_ref(uint64 addr, int cnt);
+int             put_page_ref(uint64 addr);
 void            chg_page_ref(uint64 addr, int to);
 int             get_page_ref(uint64 addr);
-void 						acquire_page_ref();
-void						release_page_ref();
+void            kmem_pcp_stat(uint64 *, uint64 *, uint64 *, uint64 *);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -81,7 +92,15 @@ void            log_write(struct block_buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// mmap.c
+uint64          mmap(uint64, uint64, int, int, struct file*, uint64);
+int             munmap(uint64, uint64);
+void            munmapall(void);
+int             mmapfillshared(void);
+void            vmaprefault(uint64, uint64);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -99,11 +118,9 @@ void            backtrace(int user, int lineinfo);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+int             growproc(int, uint64*);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
-pagetable_t     proc_kpagetable(struct proc *);
-pagetable_t     uclean_kpagetable();
 int             kill(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
@@ -113,32 +130,59 @@ void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
+int             wait4(int, uint64, uint64);
+int             clone(uint64, uint64, uint64);
+int             join(int, uint64);
 void            wakeup(void*);
 void            yield(void);
+void            schedtick(void);
+int             nice(int);
+int             setpriority(int, int);
+int             procinfo(uint64, int);
+int             cpustat(int, uint64*, uint64*);
+int             nrunnable(void);
+void            ipi(int, int);
+int             ipirecv(void);
+void            preempt(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 int 						proc_rand(struct proc *p);
-void            proc_free_pagetable(struct proc *p);
-void            proc_free_kpagetable(struct proc *p, uint64);
+void            proc_free_pagetable(struct proc *p, uint64);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
+void            swtchsatp(struct context*, struct context*, uint64);
+
+// umem.S
+int             umemmove(void*, void*, uint64);
 
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
+int             tryacquire(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            kmem_cache_dump(void);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// start.c
+int             timerfired(void);
+void            timerset(uint64);
+
 // strtol.c
 long strtol(const char *nptr, char **endptr, int base);
 unsigned long strtoul(const char *nptr, char **endptr, int base);
@@ -156,6 +200,11 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// timer.c
+void            timersinit(void);
+int             timersleep(uint64);
+void            timerintr(void);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
@@ -174,11 +223,17 @@ int             uartgetc(void);
 pagetable_t			kvmmake(void);
 void            kvminit(void);
 void            kvminithart(void);
+void            kvmswitch(struct proc *);
+uint64          kvmsatp(struct proc *);
+void            tlbflush(struct proc *, uint64, uint64);
+void            tlbpoll(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
+pagetable_t     kvmcreate(void);
+void            kvmfree(pagetable_t);
 
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
+int             mapsuperpages(pagetable_t, uint64, uint64, uint64, int);
 int							map_onepage(pagetable_t, uint64, uint64, int);
-pagetable_t     upagecreate(void);
 void            upageunmap(pagetable_t, uint64, uint64, int);
 void            upageclear(pagetable_t, uint64);
 
@@ -187,12 +242,13 @@ int             uvmrealloc(struct proc *, uint64);
 int 						cowpage(struct proc *, uint64 addr);
 int             uvmdealloc(struct proc *, uint64, uint64);
 int             uvmcopy(struct proc *, struct proc *);
-int             uaddrvalid(struct proc *, uint64);
+int             uaddrvalid(struct proc *, uint64, uint64, int);
 
 uint64  				vmpa(pagetable_t pagetable, uint64 va);
 uint64          kvmpa(uint64 va);
 uint64          walkaddr(pagetable_t, uint64);
 pte_t *         walk(pagetable_t pagetable, uint64 va, int alloc);
+pte_t *         walklevel(pagetable_t pagetable, uint64 va, int alloc, int level);
 int             free_pagetable(pagetable_t pagetable, int);
 
 int             copyout(pagetable_t, uint64, char *, uint64);
@@ -203,12 +259,28 @@ void            vmprint(pagetable_t);
 void						xprint(pagetable_t pagetable, uint64 srcva, uint64 bytes);
 void 						print_page_info(pagetable_t pagetable);
 
+// vma.c
+void            vmainit(void);
+struct vma*     vmafind(struct proc*, uint64);
+int             vmaoverlap(struct proc*, uint64, uint64);
+uint64          vmaplace(struct proc*, uint64, uint64);
+struct vma*     vmainsert(struct proc*, uint64, uint64, int, int, struct vmaops*);
+void            vmaremove(struct proc*, struct vma*);
+struct vma*     vmaheap(struct proc*);
+int             vmagrowdown(struct proc*, uint64);
+int             vmapopulate(struct proc*, uint64, uint64);
+
 // plic.c
 void            plicinit(void);
 void            plicinithart(void);
 int             plic_claim(void);
 void            plic_complete(int);
 
+// vdso.c
+extern struct vdso *vdso;
+void            vdsoinit(void);
+void            vdsotick(uint);
+
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct block_buf *, int);
@@ -26,6 +26,7 @@ struct superblock {
   uint nbmap;        // Number of free map block
   uint datastart;    // Block number of first data block
   uint ndata;        // Number of data blocks
+  uint nfree;        // Number of free blocks, kept up to date by balloc/bfree
 };
 
 #define NDIRECT 11
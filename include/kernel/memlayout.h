@@ -30,6 +30,7 @@
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // software interrupt pending
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
@@ -65,6 +66,8 @@
 //   expandable heap
 //   expandable stack
 //   ...
+//   VDSO (the same page in every process)
+//   USYSCALL (p->usyscall)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
@@ -74,11 +77,39 @@
 struct usyscall {
   int pid;  // Process ID
   char cwd[MAXPATH];
+  int hart; // hart the process last started running on
 };
 
-// map kernel stacks beneath the usyscall
+// clock and load average for user space, see vdso.c.
+#define VDSO (USYSCALL - PGSIZE)
+struct vdso {
+  uint seq;        // odd while the kernel updates the rest
+  uint ticks;      // as returned by uptime()
+  uint64 time;     // r_time() at the last tick
+  uint64 timebase; // r_time() cycles per second
+  uint loadavg;    // runnable processes over the last minute,
+                   // in units of 1/LOADSCALE
+};
+#define LOADSHIFT 11
+#define LOADSCALE (1 << LOADSHIFT)
+
+// map kernel stacks beneath the vdso
 // each surrounded by invalid guard pages.
-#define KSTACK(p) (USYSCALL - ((p)+1)* 2*PGSIZE)
+#define KSTACK(p) (VDSO - ((p)+1)* 2*PGSIZE)
+
+// the trapframes of threads, beneath the kernel stacks, by
+// the thread's slot in proc[]. mapped in the page table of
+// its group only; see clone().
+#define THREADFRAME(p) (KSTACK(NPROC) - (p)*PGSIZE)
+
+// the heap starts in the first GiB above RAM, so that the
+// GiBs of the kernel map are the same in every process's
+// page table and can be shared (see kvmcreate()).
+#define HEAP_BASE ((PHYSTOP + (1L << 30) - 1) & ~((1L << 30) - 1))
+#define HEAP_START(p) (HEAP_BASE + (proc_rand(p) % 0x100 + 1) * PGSIZE)
+// mmap() places its regions here, in GiBs of their own far
+// above any heap and below those of the stack.
+#define MMAP_BASE (MAXVA / 2)
+#define MMAP_END (MAXVA - (1L << 30))
 
-#define HEAP_START(p) (PHYSTOP + (proc_rand(p) % 0x100 + 1) * PGSIZE)
-#define STACK_TOP(p) (USYSCALL - (proc_rand(p) % 0x100 + NPROC * 2 + 5) * PGSIZE)
\ No newline at end of file
+#define STACK_TOP(p) (VDSO - (proc_rand(p) % 0x100 + NPROC * 3 + 5) * PGSIZE)
\ No newline at end of file
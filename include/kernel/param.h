@@ -1,15 +1,18 @@
 #pragma once
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define NPRIO         4  // scheduling levels
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
+#define NVMA         20  // memory regions per process
+#define FAULTAROUND  16  // pages a heap or stack fault maps, when in order
 #define NINODES 		200  // number of inodes
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGSIZE      (MAXOPBLOCKS*3+1)  // max data blocks in on-disk log, +1 for the superblock
+#define NBUF         (MAXOPBLOCKS*3+1)  // size of disk block cache
 #define FSSIZE       200000  // size of file system in blocks
 #define MAXPATH      256   // maximum file path name
+#define TIMEBASE     10000000  // r_time() cycles per second in qemu
+#define TICKCYCLES   1000000   // cycles between ticks; about 1/10th second
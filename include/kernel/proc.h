@@ -4,6 +4,7 @@
 #include "kernel/param.h"
 #include "kernel/riscv.h"
 #include "kernel/spinlock.h"
+#include "user/system.h"
 
 // Saved registers for kernel context switches.
 struct context {
@@ -31,25 +32,40 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asid_gen;            // ASID generation at the last full TLB flush
+  struct proc *next;          // last woken here, to switch to directly
+  struct proc *prev;          // switched away from directly, still locked
+  int nhandoff;               // direct switches since the scheduler ran
+  int started;                // in scheduler() since starttime
+  int idle;                   // in wfi, or about to be; see idle()
+  uint64 starttime;           // r_time() when the hart started
+  uint64 idletime;            // time spent in wfi, in r_time() cycles
+  int ipi;                    // IPI_* sent here, not yet handled
+  uint flushreq;              // TLB flushes asked of this hart
+  uint nflush;                // and done, see tlbflush()
 };
 
+// what an IPI asks of the hart it interrupts, see ipi().
+#define IPI_RESCHED 1   // look at the run queue again
+#define IPI_TLBFLUSH 2  // flush the TLB, see tlbflush()
+
 extern struct cpu cpus[NCPU];
 
 // per-process data for the trap handling code in trampoline.S.
 // sits in a page by itself just under the trampoline page in the
-// user page table. not specially mapped in the kernel page table.
+// process's page table, which user and kernel share.
 // the sscratch register points here.
 // uservec in trampoline.S saves user registers in the trapframe,
 // then initializes registers from the trapframe's
-// kernel_sp, kernel_hartid, kernel_satp, and jumps to kernel_trap.
+// kernel_sp, kernel_hartid, and jumps to kernel_trap.
 // usertrapret() and userret in trampoline.S set up
 // the trapframe's kernel_*, restore user registers from the
-// trapframe, switch to the user page table, and enter user space.
+// trapframe, and enter user space.
 // the trapframe includes callee-saved user registers like s0-s11 because the
 // return-to-user path via usertrapret() doesn't return through
 // the entire kernel call stack.
 struct trapframe {
-  /*   0 */ uint64 kernel_satp;   // kernel page table
+  /*   0 */ uint64 kernel_satp;   // unused, the page table stays
   /*   8 */ uint64 kernel_sp;     // top of process's kernel stack
   /*  16 */ uint64 kernel_trap;   // usertrap()
   /*  24 */ uint64 epc;           // saved user program counter
@@ -99,11 +115,6 @@ struct addrinfo {
   uint64 program_sz;         // program code bytes
 };
 
-struct kpagetable_wrapper {
-  pagetable_t page;
-  int occupied;
-};
-
 #define addrinfo_clear(addrinfo) do { \
   addrinfo.logical_stack_top = 0; \
   addrinfo.stack_top = 0; \
@@ -114,6 +125,31 @@ struct kpagetable_wrapper {
   addrinfo.program_sz = 0; \
 } while(0)
 
+struct vma;
+
+// What a kind of region does about a page fault at va, which
+// is in v, with g->vmlock held; access is PROT_READ,
+// PROT_WRITE or PROT_EXEC. Returns 0 once the access can be
+// retried, or -1 if it is not allowed.
+struct vmaops {
+  char *name;
+  int (*fault)(struct proc *g, struct vma *v, uint64 va, int access);
+};
+
+extern struct vmaops codeops, heapops, stackops, mmapops;
+
+// A region of a process's address space, file-backed if f is
+// not 0 (only mmap() regions are).
+struct vma {
+  uint64 start;
+  uint64 end;                // may equal start, for an empty heap
+  int prot;                  // PROT_*
+  int flags;                 // MAP_*
+  struct file *f;            // holds a reference
+  uint64 off;                // of start in f
+  struct vmaops *ops;
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -124,26 +160,54 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
-
-  // wait_lock must be held when using this:
-  struct proc *parent;         // Parent process
+  struct runq *rq;             // run queue p is on, if RUNNABLE
+  struct proc *rq_next;        // and its neighbours there
+  struct proc *rq_prev;
+  int cpu;                     // hart p last ran on
+  int prio;                    // MLFQ level, 0 runs first; while
+  int used;                    //   queued, these two and boost are
+  uint boost;                  //   under p->rq->lock instead
+  int nice;                    // level p starts at and is boosted to
+  struct waitq *wq;            // wait queue p is on, while sleeping
+  struct proc *wq_next;        // and its neighbours there
+  struct proc *wq_prev;
+
+  // wait_lock must be held when using these:
+  struct proc *parent;         // Parent process, 0 for a thread
+  int nthreads;                // threads of this group leader
+  struct rusage cru;           // of the children and threads freed
 
   // these are private to the process, so (p)->lock need not be held.
   uint64 kstackbase;           // Virtual address of kernel stack
   uint64 *kstackpage;          // kernel stack page
-  struct addrinfo addrinfo; 
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // where trapframe is in the user page table
+  struct proc *group;          // thread group leader, p itself if none
+  struct rusage ru;            // usage so far, times in r_time() cycles
+  uint64 rustamp;              // r_time() when time was last charged
+
+  // the group leader's, shared by its threads; vmlock guards
+  // the page tables, addrinfo and vma[], and the leader's p->lock
+  // the ofile slots and cwd.
+  struct spinlock vmlock;
+  struct addrinfo addrinfo; 
+  struct vma vma[NVMA];        // regions, sorted by start
+  int nvma;                    // of vma[] in use
   struct usyscall *usyscall;   // usyscall page
 
-  pagetable_t pagetable;       // User page table
-  pagetable_t kpagetable;      // User kernel page table
+  // a thread has its leader's page tables, and only the
+  // leader's asid, tlbstale, ofile and cwd are used.
+  pagetable_t pagetable;       // Page table, user and kernel
+  uint64 asid_gen;             // generation of asid, see kvmswitch()
+  uint16 asid;                 // ASID of pagetable, 0 if the harts have none
+  uint tlbstale;               // harts that must flush asid before running us
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
   char path[MAXPATH];          // executable path (debugging)
 
-  int trace_mask;    // trace系统调用参数
+  uint64 trace_mask; // trace系统调用参数
   uint random_seed;
 };
 
@@ -43,6 +43,7 @@ w_mepc(uint64 x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_SUM (1L << 18) // Supervisor may access User pages
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -199,8 +200,14 @@ w_pmpaddr0(uint64 x)
 // use riscv's sv39 page table scheme.
 #define SATP_SV39 (8L << 60)
 
-#define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)(pagetable)) >> 12))
-#define GET_PAGETABLE(satp) (((satp) & (~SATP_SV39)) << 12)
+// satp bits 44..59 hold the address-space ID. TLB entries are
+// tagged with it, so a switch between ASIDs needs no flush.
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MAX 0xFFFF
+
+#define MAKE_SATP(pagetable, asid) (SATP_SV39 | ((uint64)(asid) << SATP_ASID_SHIFT) | (((uint64)(pagetable)) >> 12))
+#define GET_PAGETABLE(satp) (((satp) & ((1L << SATP_ASID_SHIFT) - 1)) << 12)
+#define GET_ASID(satp) (((satp) >> SATP_ASID_SHIFT) & SATP_ASID_MAX)
 
 // supervisor address translation and protection;
 // holds the address of the page table.
@@ -264,6 +271,21 @@ r_mcounteren()
   return x;
 }
 
+// Supervisor-mode Counter-Enable
+static inline void 
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -273,6 +295,14 @@ r_time()
   return x;
 }
 
+// stall the hart until an interrupt is pending,
+// whether or not interrupts are enabled.
+static inline void
+wfi()
+{
+  asm volatile("wfi");
+}
+
 // enable device interrupts
 static inline void
 intr_on()
@@ -343,6 +373,20 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
+// flush the TLB entry for va in one address space.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid));
+}
+
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
@@ -356,6 +400,7 @@ sfence_vma()
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
 #define PTE_A (1L << 6) // accessed
+#define PTE_D (1L << 7) // dirty
 #define PTE_COW (1L << 8)
 
 // shift a physical address to the right place for a PTE.
@@ -364,12 +409,16 @@ sfence_vma()
 #define PTE2PA(pte) (((pte) >> 10) << 12)
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
+// a valid PTE with any of R/W/X is a leaf, at any level.
+#define PTE_LEAF(pte) ((pte) & (PTE_R|PTE_W|PTE_X))
 #define PTE_WITH_FLAGS(pte, flags) (((pte) & (~0x3FF)) | flags)
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
 // level from high bit to low bit: 2 1 0
 #define PX(level, va) ((((uint64) (va)) >> PXSHIFT(level)) & PXMASK)
+// bytes mapped by a leaf at level: 4 KiB, 2 MiB, 1 GiB.
+#define LEVELSIZE(level) (1L << PXSHIFT(level))
 #define E2VA(high, middle, low) (((high) << PXSHIFT(2)) | ((middle) << PXSHIFT(1)) | ((low) << PXSHIFT(0))) 
 
 // one beyond the highest possible virtual address.
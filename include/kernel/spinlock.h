@@ -16,7 +16,6 @@ int bscanf(const char *buffer, const char *format, ...);
 
 static inline int lock_blacklist(struct spinlock *lk) {
   if (strcmp(lk->name, "kmem") == 0 ||
-      strcmp(lk->name, "kpage_ref") == 0 ||
       strcmp(lk->name, "pr") == 0 ||
       strcmp(lk->name, "time") == 0 ||
       strcmp(lk->name, "uart") == 0)
@@ -24,4 +24,16 @@ DEF_SYSCALL(21, close)
 DEF_SYSCALL(22, trace)
 DEF_SYSCALL(23, pgaccess)
 DEF_SYSCALL(24, system_info)
+DEF_SYSCALL(25, nice)
+DEF_SYSCALL(26, setpriority)
+DEF_SYSCALL(27, getprocs)
+DEF_SYSCALL(28, nanosleep)
+DEF_SYSCALL(29, clone)
+DEF_SYSCALL(30, join)
+DEF_SYSCALL(31, futex_wait)
+DEF_SYSCALL(32, futex_wake)
+DEF_SYSCALL(33, wait4)
+DEF_SYSCALL(34, mmap)
+DEF_SYSCALL(35, munmap)
+DEF_SYSCALL(36, madvise)
 #endif
\ No newline at end of file
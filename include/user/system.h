@@ -1,7 +1,42 @@
 #pragma once
+#include "common/types.h"
+#include "kernel/param.h"
 
 struct system_info {
 	int memleft; // byte
 	int diskleft; // byte
 	int n_cpu;
-};
\ No newline at end of file
+	uint64 pcp_alloc_hit;  // kalloc() served by a per-cpu page cache
+	uint64 pcp_alloc_miss;
+	uint64 pcp_free_hit;   // kfree() absorbed by a per-cpu page cache
+	uint64 pcp_free_miss;
+	// per hart, for the first n_cpu: time spent in wfi and
+	// the rest since it started, in timer cycles.
+	uint64 idle_cycles[NCPU];
+	uint64 busy_cycles[NCPU];
+};
+
+// one process, as listed by getprocs().
+struct procinfo {
+	int pid;
+	char state[8];
+	int prio;     // current MLFQ level, 0 runs first
+	int nice;     // level it starts at and is boosted back to
+	char name[16];
+};
+
+// what a process and the children it waited for have used,
+// as returned by wait4().
+struct rusage {
+	uint64 utime;   // time in user space, in microseconds
+	uint64 stime;   // time in the kernel, in microseconds
+	uint64 rchar;   // bytes read
+	uint64 wchar;   // bytes written
+	int minflt;     // heap and stack pages faulted in
+	int cowflt;     // copy-on-write faults
+	int zeroflt;    // of minflt, reads given the shared zero page
+	int nvcsw;      // switches away to wait for something
+	int nivcsw;     // switches away when preempted
+	int inblock;    // disk blocks read
+	int oublock;    // disk blocks written
+};
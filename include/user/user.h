@@ -27,9 +27,21 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
-int trace(int);
+int trace(uint64);
 int pgaccess(const void*, int, void*);
 int system_info(struct system_info*);
+int nice(int);
+int setpriority(int, int);
+int getprocs(struct procinfo*, int);
+int nanosleep(uint64);
+int clone(void (*)(void*), void*, void*);
+int join(int, int*);
+int futex_wait(uint*, uint);
+int futex_wake(uint*, int);
+int wait4(int, int*, struct rusage*);
+void* mmap(void*, uint64, int, int, int, uint64);
+int munmap(void*, uint64);
+int madvise(void*, uint64, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,4 +52,34 @@ char* gets(char*, int max);
 void* malloc(uint);
 void free(void*);
 int ugetpid(void);
-char *getcwd(char *buf, int size);
\ No newline at end of file
+int ugethart(void);
+uint uuptime(void);
+uint64 unanotime(void);
+uint uloadavg(void);
+int thread_create(int (*)(void*), void*, void*, int);
+char *getcwd(char *buf, int size);
+
+// mutex.c
+struct mutex {
+  uint state;
+};
+struct cond {
+  uint seq;
+};
+void mutex_lock(struct mutex*);
+int mutex_trylock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+
+// coro.c
+struct chan;
+int coro_spawn(void (*)(void*), void*);
+void coro_yield(void);
+void coro_exit(void) __attribute__((noreturn));
+int coro_run(int);
+struct chan *chan_new(int);
+void chan_free(struct chan*);
+void chan_send(struct chan*, uint64);
+uint64 chan_recv(struct chan*);
@@ -16,6 +16,8 @@
 #include "common/types.h"
 #include "kernel/param.h"
 #include "kernel/spinlock.h"
+#include "kernel/riscv.h"
+#include "kernel/proc.h"
 #include "kernel/defs.h"
 #include "kernel/buf.h"
 
@@ -92,6 +94,8 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
+    if(myproc())
+      myproc()->ru.inblock++;
     virtio_disk_rw(b, 0);
     b->valid = 1;
   }
@@ -104,6 +108,8 @@ bwrite(struct block_buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
+  if(myproc())
+    myproc()->ru.oublock++;
   virtio_disk_rw(b, 1);
 }
 
@@ -6,6 +6,7 @@
 #include "kernel/proc.h"
 #include "kernel/defs.h"
 #include "kernel/elf.h"
+#include "kernel/fcntl.h"
 
 static int loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz);
 
@@ -17,19 +18,29 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma *code;
   uint64 argc, sp, stackbase, ustack[MAXARG];
 
   struct proc *p = myproc();
-  struct proc p_bak = *p;
-  struct proc p_new = *p;
-  p_new.pagetable = 0;
-  p_new.kpagetable = 0;
-  addrinfo_clear(p_new.addrinfo);
+
+  // the other threads would lose their memory.
+  if(p->group != p || p->nthreads > 0)
+    return -1;
+
+  // too big for the kernel stack, with its regions.
+  struct proc *p_new = (struct proc *)kalloc();
+  if(p_new == 0)
+    return -1;
+  *p_new = *p;
+  p_new->pagetable = 0;
+  p_new->nvma = 0;
+  addrinfo_clear(p_new->addrinfo);
 
   begin_op();
 
   if((ip = namei(path)) == 0){
     end_op();
+    kfree(p_new);
     return -1;
   }
   ilock(ip);
@@ -40,10 +51,11 @@ exec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
-  if((p_new.pagetable = proc_pagetable(p)) == 0)
-    goto bad;
-  if((p_new.kpagetable = proc_kpagetable(p)) == 0)
+  if((p_new->pagetable = proc_pagetable(p)) == 0)
     goto bad;
+  // grows to cover each segment as it is loaded, so that
+  // proc_free_pagetable() finds what was.
+  code = vmainsert(p_new, 0, 0, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_PRIVATE, &codeops);
 
   // Load program into memory.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
@@ -55,14 +67,16 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-   if((uvmalloc(&p_new, 
-          p_new.addrinfo.program_sz + ph.vaddr, 
-          p_new.addrinfo.program_sz + ph.vaddr + ph.memsz
+   if((uvmalloc(p_new, 
+          p_new->addrinfo.program_sz + ph.vaddr, 
+          p_new->addrinfo.program_sz + ph.vaddr + ph.memsz
         )) == -1)
       goto bad;
-    p_new.addrinfo.vm_offset = ph.vaddr;
-    p_new.addrinfo.program_sz += ph.memsz;
-    if(loadseg(p_new.pagetable, p_new.addrinfo.vm_offset, ip, ph.off, ph.filesz) < 0)
+    p_new->addrinfo.vm_offset = ph.vaddr;
+    p_new->addrinfo.program_sz += ph.memsz;
+    code->start = PROC_CODE_BASE(p_new);
+    code->end = PROC_CODE_END(p_new);
+    if(loadseg(p_new->pagetable, p_new->addrinfo.vm_offset, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
   iunlockput(ip);
@@ -73,10 +87,17 @@ exec(char *path, char **argv)
   // Use the second as the user stack.
   sp = STACK_TOP(p);
   stackbase = sp - PGSIZE;
-  if((uvmalloc(&p_new, stackbase, sp)) == -1)
+  if((uvmalloc(p_new, stackbase, sp)) == -1)
+    goto bad;
+  p_new->addrinfo.stack_top = sp;
+  p_new->addrinfo.stack_bottom = stackbase;
+  if(vmainsert(p_new, stackbase, sp, PROT_READ|PROT_WRITE, MAP_PRIVATE, &stackops) == 0)
+    goto bad;
+  p_new->addrinfo.heap_start = HEAP_START(p);
+  p_new->addrinfo.heap_end = p_new->addrinfo.heap_start;
+  if(vmainsert(p_new, p_new->addrinfo.heap_start, p_new->addrinfo.heap_start,
+               PROT_READ|PROT_WRITE, MAP_PRIVATE, &heapops) == 0)
     goto bad;
-  p_new.addrinfo.stack_top = sp;
-  p_new.addrinfo.stack_bottom = stackbase;
 
   // Push argument strings, prepare rest of stack in ustack.
   for(argc = 0; argv[argc]; argc++) {
@@ -86,7 +107,7 @@ exec(char *path, char **argv)
     sp -= sp % 16; // riscv sp must be 16-byte aligned
     if(sp < stackbase)
       goto bad;
-    if(copyout(p_new.pagetable, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
+    if(copyout(p_new->pagetable, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
       goto bad;
     ustack[argc] = sp;
   }
@@ -97,7 +118,7 @@ exec(char *path, char **argv)
   sp -= sp % 16;
   if(sp < stackbase)
     goto bad;
-  if(copyout(p_new.pagetable, sp, (char *)ustack, (argc+1)*sizeof(uint64)) < 0)
+  if(copyout(p_new->pagetable, sp, (char *)ustack, (argc+1)*sizeof(uint64)) < 0)
     goto bad;
 
   // arguments to user main(argc, argv)
@@ -106,28 +127,34 @@ exec(char *path, char **argv)
   p->trapframe->a1 = sp;
 
   // Save program name for debugging.
-  safestrcpy(p_new.path, path, sizeof(p_new.path));
+  safestrcpy(p_new->path, path, sizeof(p_new->path));
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(p_new.name, last, sizeof(p_new.name));
+  safestrcpy(p_new->name, last, sizeof(p_new->name));
     
-  proc_free_pagetable(&p_bak);
-  proc_free_kpagetable(&p_bak, MAKE_SATP(p_new.kpagetable));
+  munmapall();
+  // other harts may hold the old image under our ASID. no switch
+  // until p has the new table: a switch back would load the old
+  // one while it is being freed. off the old table, which has
+  // our kernel stack, first.
+  tlbflush(p, 0, 0);
+  push_off();
+  proc_free_pagetable(p, MAKE_SATP(p_new->pagetable, p->asid));
   // Commit to the user image.
-  p_new.trapframe->epc = elf.entry;  // initial program counter = main
-  p_new.trapframe->sp = sp; // initial stack pointer
-  p_new.trapframe->s0 = sp; // initial frame top
-  p_new.addrinfo.logical_stack_top = sp; // initial frame top
-  p_new.addrinfo.heap_start = HEAP_START(p);
-  p_new.addrinfo.heap_end = p_new.addrinfo.heap_start;
-  *p = p_new;
+  p_new->trapframe->epc = elf.entry;  // initial program counter = main
+  p_new->trapframe->sp = sp; // initial stack pointer
+  p_new->trapframe->s0 = sp; // initial frame top
+  p_new->addrinfo.logical_stack_top = sp; // initial frame top
+  *p = *p_new;
+  pop_off();
+  kfree(p_new);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
-  proc_free_pagetable(&p_new);
-  proc_free_kpagetable(&p_new, 0);
+  proc_free_pagetable(p_new, 0);
+  kfree(p_new);
   if(ip){
     iunlockput(ip);
     end_op();
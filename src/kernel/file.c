@@ -3,6 +3,7 @@
 //
 
 #include "common/types.h"
+#include "common/stdlib.h"
 #include "kernel/defs.h"
 #include "kernel/param.h"
 #include "kernel/fs.h"
@@ -11,15 +12,17 @@
 #include "kernel/stat.h"
 
 struct devsw devsw[NDEV];
+// open files come from file_cache; the lock protects f->ref.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kmem_cache *file_cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.file_cache = kmem_cache_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -28,16 +31,11 @@ filealloc(void)
 {
   struct file *f;
 
-  ACQUIRE(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      RELEASE(&ftable.lock);
-      return f;
-    }
-  }
-  RELEASE(&ftable.lock);
-  return NULL;
+  if((f = kmem_cache_alloc(ftable.file_cache)) == 0)
+    return NULL;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,6 +67,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   RELEASE(&ftable.lock);
+  kmem_cache_free(ftable.file_cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
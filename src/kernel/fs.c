@@ -24,6 +24,8 @@
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
+// sb.nfree as last logged to disk
+static uint sb_nfree_logged;
 
 // Read the super block.
 static void
@@ -43,6 +45,26 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  // recovery may have installed a newer superblock.
+  readsb(dev, &sb);
+  sb_nfree_logged = sb.nfree;
+}
+
+// Log the superblock if the free block count changed in
+// this transaction. Called by end_op() right before commit,
+// when no FS operation is running.
+void
+fslogsb(int dev)
+{
+  struct block_buf *bp;
+
+  if(sb.nfree == sb_nfree_logged)
+    return;
+  bp = bread(dev, 1);
+  ((struct superblock*)bp->data)->nfree = sb.nfree;
+  log_write(bp);
+  brelease(bp);
+  sb_nfree_logged = sb.nfree;
 }
 
 // Zero a block.
@@ -75,6 +97,7 @@ balloc(uint dev)
         bp->data[bi/8] |= m;  // Mark block in use.
         log_write(bp);
         brelease(bp);
+        __atomic_sub_fetch(&sb.nfree, 1, __ATOMIC_RELAXED);
         bzero(dev, b + bi);
         return b + bi;
       }
@@ -99,6 +122,7 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelease(bp);
+  __atomic_add_fetch(&sb.nfree, 1, __ATOMIC_RELAXED);
 }
 
 // Inodes.
@@ -161,8 +185,13 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
+// In-memory inodes are allocated from inode_cache on first
+// reference and freed when ip->ref drops to zero. itable.hash
+// chains the referenced inodes by (dev, inum), so iget()
+// does not scan every inode.
+//
 // The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
+// entries. Since ip->ref indicates whether an entry is live,
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold itable.lock while using any of those fields.
 //
@@ -170,20 +199,20 @@ bfree(int dev, uint b)
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NINODEHASH 61
+#define INODEHASH(dev, inum) (((dev) * 31 + (inum)) % NINODEHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *inode_cache;
+  struct inode *hash[NINODEHASH];
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  itable.inode_cache = kmem_cache_create("inode", sizeof(struct inode));
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -241,31 +270,31 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  struct inode **bucket = &itable.hash[INODEHASH(dev, inum)];
 
   ACQUIRE(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = *bucket; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       RELEASE(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Allocate a new entry.
+  if((ip = kmem_cache_alloc(itable.inode_cache)) == 0)
     panic("iget: no inodes");
 
-  ip = empty;
+  initsleeplock(&ip->lock, "inode");
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->next = *bucket;
+  *bucket = ip;
   RELEASE(&itable.lock);
 
   return ip;
@@ -322,8 +351,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry is
+// freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -353,6 +382,13 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0){
+    struct inode **pp = &itable.hash[INODEHASH(ip->dev, ip->inum)];
+    while(*pp != ip)
+      pp = &(*pp)->next;
+    *pp = ip->next;
+    kmem_cache_free(itable.inode_cache, ip);
+  }
   RELEASE(&itable.lock);
 }
 
@@ -670,11 +706,17 @@ static struct inode*
 namex(const char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  struct proc *g;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  else {
+    // another thread may chdir() meanwhile.
+    g = myproc()->group;
+    ACQUIRE(&g->lock);
+    ip = idup(g->cwd);
+    RELEASE(&g->lock);
+  }
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
@@ -714,23 +756,9 @@ nameiparent(const char *path, char *name)
   return namex(path, 1, name);
 }
 
+// Free blocks on the root device.
 int
 diskleft()
 {
-  int b, bi, m;
-  struct block_buf *bp;
-  int ret = 0;
-
-  bp = 0;
-  for(b = 0; b < sb.size; b += BIT_PER_BLOCK){
-    bp = bread(ROOTDEV, BITMAP_BLOCK(b, sb));
-    for(bi = 0; bi < BIT_PER_BLOCK && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        ret++;
-      }
-    }
-    brelease(bp);
-  }
-  return ret;
+  return sb.nfree;
 }
\ No newline at end of file
@@ -0,0 +1,178 @@
+// Futexes: sleeping on a word of user memory.
+//
+// futex_wait(addr, val) sleeps as long as the word at addr
+// holds val; futex_wake(addr, n) wakes up to n sleepers on it.
+// A futex in a shared mapping is known by the physical
+// address of the word, so that it is the same one in every
+// process that maps it. Any other is private to its thread
+// group, and known by the group and the virtual address: its
+// physical address changes when fork() makes the page
+// copy-on-write and a write then copies it. The sleepers are
+// hashed by the key, and each waits in its own slot of
+// pwaiter[]: a waker in another process could not reach one
+// on the sleeper's kernel stack, which only the sleeper's page
+// table maps.
+//
+// The check of the word and the going to sleep happen under
+// the bucket lock, which futex_wake() also takes, so a wake
+// after the word has been changed is not lost.
+
+#include "common/types.h"
+#include "kernel/param.h"
+#include "kernel/memlayout.h"
+#include "kernel/spinlock.h"
+#include "kernel/riscv.h"
+#include "kernel/proc.h"
+#include "kernel/defs.h"
+#include "kernel/fcntl.h"
+
+#define NFUTEX 31
+#define FUTEX(k) (&futexes[(((k).addr >> 2) ^ (uint64)(k).g) % NFUTEX])
+
+struct futexkey {
+  struct proc *g;             // group of a private futex, or 0
+  uint64 addr;                // va if private, else pa
+};
+
+struct futexwaiter {
+  struct futexkey key;        // the word waited on
+  int woken;
+  struct futexwaiter *next;
+};
+
+struct futexq {
+  struct spinlock lock;
+  struct futexwaiter *head;
+} futexes[NFUTEX];
+
+extern struct proc proc[NPROC];
+static struct futexwaiter pwaiter[NPROC];
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NFUTEX; i++)
+    initlock(&futexes[i].lock, "futex");
+}
+
+// Find the key of the user word at va. Returns 0, or -1 if
+// va is in a shared mapping and not mapped.
+static int
+futexkey(uint64 va, struct futexkey *k)
+{
+  struct proc *g = myproc()->group;
+  struct vma *v;
+  pte_t *pte;
+  int r = -1;
+
+  ACQUIRE(&g->vmlock);
+  if((v = vmafind(g, va)) != 0 && (v->flags & MAP_SHARED)){
+    if((pte = walk(g->pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0)
+      goto out;
+    k->g = 0;
+    k->addr = PTE2PA(*pte) + (va & (PGSIZE - 1));
+  } else {
+    k->g = g;
+    k->addr = va;
+  }
+  r = 0;
+out:
+  RELEASE(&g->vmlock);
+  return r;
+}
+
+// Read the user word at va into *val, through the page it is
+// in now, or return -1 if there is none.
+static int
+futexword(uint64 va, uint *val)
+{
+  struct proc *g = myproc()->group;
+  pte_t *pte;
+  int r = -1;
+
+  ACQUIRE(&g->vmlock);
+  if((pte = walk(g->pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    *val = *(volatile uint*)(PTE2PA(*pte) + (va & (PGSIZE - 1)));
+    r = 0;
+  }
+  RELEASE(&g->vmlock);
+  return r;
+}
+
+static int
+samekey(struct futexkey *a, struct futexkey *b)
+{
+  return a->g == b->g && a->addr == b->addr;
+}
+
+// Sleep until woken by futex_wake(), unless the word at va
+// does not hold val. Returns 0 if woken, -1 otherwise.
+int
+futex_wait(uint64 va, uint val)
+{
+  struct proc *p = myproc();
+  struct futexwaiter *w = &pwaiter[p - proc], **pp;
+  struct futexq *q;
+  uint cur;
+
+  if(va % sizeof(uint) != 0)
+    return -1;
+  // fault the page in, if lazy.
+  if(copyin((char*)&cur, va, sizeof(cur)) < 0 || cur != val)
+    return -1;
+  if(futexkey(va, &w->key) < 0)
+    return -1;
+  w->woken = 0;
+  q = FUTEX(w->key);
+
+  ACQUIRE(&q->lock);
+  if(futexword(va, &cur) < 0 || cur != val){
+    RELEASE(&q->lock);
+    return -1;
+  }
+  // at the tail, so that they are woken in turn.
+  for(pp = &q->head; *pp; pp = &(*pp)->next)
+    ;
+  w->next = 0;
+  *pp = w;
+  while(!w->woken && !p->killed)
+    sleep(w, &q->lock);
+  if(!w->woken){
+    for(pp = &q->head; *pp != w; pp = &(*pp)->next)
+      ;
+    *pp = w->next;
+  }
+  RELEASE(&q->lock);
+  return w->woken ? 0 : -1;
+}
+
+// Wake up to n of the sleepers on the word at va, those that
+// have waited longest first. Returns how many.
+int
+futex_wake(uint64 va, int n)
+{
+  struct futexwaiter **pp, *w;
+  struct futexq *q;
+  struct futexkey k;
+  int woken = 0;
+
+  if(va % sizeof(uint) != 0 || !uaddrvalid(myproc(), va, sizeof(uint), PROT_READ))
+    return -1;
+  if(futexkey(va, &k) < 0)
+    return 0;   // never touched, so nobody waits on it
+  q = FUTEX(k);
+
+  ACQUIRE(&q->lock);
+  for(pp = &q->head; (w = *pp) != 0 && woken < n; ){
+    if(!samekey(&w->key, &k)){
+      pp = &w->next;
+      continue;
+    }
+    *pp = w->next;
+    w->woken = 1;
+    wakeup(w);
+    woken++;
+  }
+  RELEASE(&q->lock);
+  return woken;
+}
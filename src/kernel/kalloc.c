@@ -1,8 +1,10 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole pages.
+// and pipe buffers. Allocates whole pages,
+// or physically contiguous blocks of 2^order pages.
 #include "common/types.h"
 #include "common/stdlib.h"
+#include "kernel/param.h"
 #include "kernel/memlayout.h"
 #include "kernel/spinlock.h"
 #include "kernel/riscv.h"
@@ -12,88 +14,242 @@ void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel, defined by kernel.ld.
 
+// Free blocks are kept by a buddy allocator. A block of
+// order k is 2^k pages, naturally aligned in physical memory
+// (relative to KERNBASE), and its buddy is the block whose
+// address differs only in bit (PGSHIFT + k). Freeing a block
+// whose buddy is also free merges the two into one block of
+// order k+1.
+#define KMEM_MAX_ORDER 10  // largest block: 2^10 pages, 4 MiB
 
+#define ORDER_BYTES(order) ((uint64)PGSIZE << (order))
+#define BUDDY(pa, order) (KERNBASE + (((pa) - KERNBASE) ^ ORDER_BYTES(order)))
+
+// free lists are circular, with kmem.freelist[k] as the head.
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run freelist[KMEM_MAX_ORDER + 1];
+  int nfree;          // pages on the free lists
   int max_pagenum;
   uint64 start;
   int inited;
 } kmem;
 
-struct {
-  struct spinlock lock;
-  uchar *v;
-} kpage_ref;
+// Per-page metadata, indexed by (pa - kmem.start) / PGSIZE.
+// ref is only changed with atomic memory operations
+// (amoadd.w), so sharing and unsharing COW pages takes no lock.
+struct kpage {
+  uint ref;     // number of users sharing the page (COW)
+  char order;   // order of the free block this page heads, or -1
+};
+
+struct kpage *kpages;
+
+#define PA2KPAGE(pa) (&kpages[(PGROUNDDOWN(pa) - kmem.start) / PGSIZE])
+
+// Per-CPU cache of free pages in front of the buddy lists.
+// Only touched by its own hart with interrupts off, so
+// kalloc() and kfree() take no shared lock unless the
+// cache runs empty or full, and then move KMEM_PCP_BATCH
+// pages at once.
+#define KMEM_PCP_MAX   64
+#define KMEM_PCP_BATCH 32
+
+struct kmem_pcp {
+  struct run *list;
+  int count;
+  uint64 alloc_hit;   // kalloc() served from this cache
+  uint64 alloc_miss;  // kalloc() that refilled from the buddy lists
+  uint64 free_hit;    // kfree() kept in this cache
+  uint64 free_miss;   // kfree() that drained to the buddy lists
+};
+
+struct kmem_pcp kmem_pcp[NCPU];
+
+static void
+list_push(struct run *head, struct run *r)
+{
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+}
+
+static void
+list_remove(struct run *r)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+}
+
+// Is pa the start of a block that lies entirely in
+// the managed range?
+static int
+block_in_range(uint64 pa, int order)
+{
+  return pa >= kmem.start &&
+    pa + ORDER_BYTES(order) <= kmem.start + (uint64)kmem.max_pagenum * PGSIZE;
+}
+
+// Put the 2^order pages at pa on the free lists,
+// merging with free buddies. Caller must hold kmem.lock.
+static void
+buddy_free(uint64 pa, int order)
+{
+  kmem.nfree += 1 << order;
+  while(order < KMEM_MAX_ORDER) {
+    uint64 buddy = BUDDY(pa, order);
+    if(!block_in_range(buddy, order) || PA2KPAGE(buddy)->order != order)
+      break;
+    list_remove((struct run*)buddy);
+    PA2KPAGE(buddy)->order = -1;
+    if(buddy < pa)
+      pa = buddy;
+    order++;
+  }
+  PA2KPAGE(pa)->order = order;
+  list_push(&kmem.freelist[order], (struct run*)pa);
+}
+
+// Take a block of 2^order pages off the free lists,
+// splitting a larger block if needed.
+// Caller must hold kmem.lock. Returns 0 if none is left.
+static uint64
+buddy_alloc(int order)
+{
+  int k;
+  uint64 pa;
+
+  for(k = order; k <= KMEM_MAX_ORDER; k++)
+    if(kmem.freelist[k].next != &kmem.freelist[k])
+      break;
+  if(k > KMEM_MAX_ORDER)
+    return 0;
+
+  kmem.nfree -= 1 << order;
+  pa = (uint64)kmem.freelist[k].next;
+  list_remove((struct run*)pa);
+  PA2KPAGE(pa)->order = -1;
+  // hand the upper halves back until the block is small enough.
+  while(k > order) {
+    k--;
+    uint64 upper = pa + ORDER_BYTES(k);
+    PA2KPAGE(upper)->order = k;
+    list_push(&kmem.freelist[k], (struct run*)upper);
+  }
+  return pa;
+}
+
+// Move up to KMEM_PCP_BATCH pages from the buddy lists into pcp.
+static void
+pcp_refill(struct kmem_pcp *pcp)
+{
+  struct run *r;
+
+  ACQUIRE(&kmem.lock);
+  while(pcp->count < KMEM_PCP_BATCH && (r = (struct run*)buddy_alloc(0)) != 0) {
+    r->next = pcp->list;
+    pcp->list = r;
+    pcp->count++;
+  }
+  RELEASE(&kmem.lock);
+}
+
+// Give KMEM_PCP_BATCH pages of pcp back to the buddy lists.
+static void
+pcp_drain(struct kmem_pcp *pcp)
+{
+  struct run *r;
+
+  ACQUIRE(&kmem.lock);
+  for(int i = 0; i < KMEM_PCP_BATCH && (r = pcp->list) != 0; i++) {
+    pcp->list = r->next;
+    pcp->count--;
+    buddy_free((uint64)r, 0);
+  }
+  RELEASE(&kmem.lock);
+}
 
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
-  initlock(&kpage_ref.lock, "kpage_ref");
-  kmem.freelist = 0;
-  kmem.max_pagenum = (PHYSTOP - (uint64)end) / (PGSIZE + 1);
-  kpage_ref.v = (uchar *)end;
-  kmem.start = PGROUNDUP((uint64)end + kmem.max_pagenum);
-  
+  for (int k = 0; k <= KMEM_MAX_ORDER; k++)
+    kmem.freelist[k].next = kmem.freelist[k].prev = &kmem.freelist[k];
+  kmem.max_pagenum = (PHYSTOP - (uint64)end) / (PGSIZE + sizeof(struct kpage));
+  kpages = (struct kpage *)end;
+  kmem.start = PGROUNDUP((uint64)end + kmem.max_pagenum * sizeof(struct kpage));
+
   for (int i = 0; i < kmem.max_pagenum; i++) {
-    kpage_ref.v[i] = 1;
+    kpages[i].ref = 0;
+    kpages[i].order = -1;
   }
 
-  if (PHYSTOP - kmem.start != PGSIZE * kmem.max_pagenum) 
+  if (PHYSTOP - kmem.start < PGSIZE * kmem.max_pagenum)
     panic("kinit");
-  freerange(end + kmem.max_pagenum, (void*)PHYSTOP);
+  freerange((void*)kmem.start, (void*)(kmem.start + (uint64)kmem.max_pagenum * PGSIZE));
   kmem.inited = 1;
 }
 
+// Hand [pa_start, pa_end) to the buddy allocator in
+// the largest aligned blocks that fit.
 void
 freerange(void *pa_start, void *pa_end)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  uint64 pa = PGROUNDUP((uint64)pa_start);
+
+  ACQUIRE(&kmem.lock);
+  while(pa + PGSIZE <= (uint64)pa_end) {
+    int order = KMEM_MAX_ORDER;
+    while(order > 0 &&
+          (((pa - KERNBASE) & (ORDER_BYTES(order) - 1)) != 0 ||
+           pa + ORDER_BYTES(order) > (uint64)pa_end))
+      order--;
+    buddy_free(pa, order);
+    pa += ORDER_BYTES(order);
+  }
+  RELEASE(&kmem.lock);
 }
 
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// call to kalloc().
 void
 kfree(void *pa)
 {
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+  if(((uint64)pa % PGSIZE) != 0 || (uint64)pa < kmem.start || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
   struct run *r = (struct run*)pa;
-  if (r == kmem.freelist) {
-    printf("[warning] kfree magic error\n");
-    return;
-  }
 
-  ACQUIRE(&kpage_ref.lock);
-  int page_ref = get_page_ref((uint64)pa);
+  int page_ref = put_page_ref((uint64)pa);
   if (page_ref <= 0) {
     printf("[warning] kfree free page with ref <= 0\n");
-    RELEASE(&kpage_ref.lock);
     return;
   }
-  inc_page_ref((uint64)pa, -1);
-  RELEASE(&kpage_ref.lock);
 
   if (page_ref == 1) { // actually free
     // Fill with junk to catch dangling refs.
     memset(pa, 1, PGSIZE);
     // if (kmem.inited)
       // printf("kfree: 0x%lx\n", pa);
-    ACQUIRE(&kmem.lock);
-    r->next = kmem.freelist;
-    kmem.freelist = r;
-    RELEASE(&kmem.lock);
+    push_off();
+    struct kmem_pcp *pcp = &kmem_pcp[cpuid()];
+    if (pcp->count >= KMEM_PCP_MAX) {
+      pcp->free_miss++;
+      pcp_drain(pcp);
+    } else {
+      pcp->free_hit++;
+    }
+    r->next = pcp->list;
+    pcp->list = r;
+    pcp->count++;
+    pop_off();
     // printf("free: 0x%lx\n", pa);
   }
 }
@@ -105,65 +261,143 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kmem_pcp *pcp;
 
-  ACQUIRE(&kmem.lock);
-  r = kmem.freelist;
+  push_off();
+  pcp = &kmem_pcp[cpuid()];
+  if(pcp->count == 0) {
+    pcp->alloc_miss++;
+    pcp_refill(pcp);
+  } else {
+    pcp->alloc_hit++;
+  }
+  r = pcp->list;
   if(r) {
-    kmem.freelist = r->next;
+    pcp->list = r->next;
+    pcp->count--;
   }
-  RELEASE(&kmem.lock);
+  pop_off();
 
   if(r) {
     memset((char*)r, 5, PGSIZE); // fill with junk
     // printf("kalloc: 0x%lx\n", r);
-    ACQUIRE(&kpage_ref.lock);
     chg_page_ref((uint64)r, 1);
-    RELEASE(&kpage_ref.lock);
   }
   // printf("kalloc: 0x%lx\n", r);
   return (void*)r;
 }
 
-int 
-kmemleft()
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Order 0 goes through kalloc().
+// Returns 0 if no block that large is free.
+void *
+kalloc_pages(int order)
 {
-  int ret = 0;
-  struct run *r = kmem.freelist;
-  while (r) {
-    ret += PGSIZE;
-    if (r == r->next) {
-      printf("error memleft\n");
-      return 0;
-    }
-    r = r->next;
+  uint64 pa;
+
+  if(order < 0 || order > KMEM_MAX_ORDER)
+    return 0;
+  if(order == 0)
+    return kalloc();
+
+  ACQUIRE(&kmem.lock);
+  pa = buddy_alloc(order);
+  RELEASE(&kmem.lock);
+
+  if(pa) {
+    memset((char*)pa, 5, ORDER_BYTES(order)); // fill with junk
+    for(uint64 a = pa; a < pa + ORDER_BYTES(order); a += PGSIZE)
+      chg_page_ref(a, 1);
   }
-  return ret;
+  return (void*)pa;
 }
 
-void 
-acquire_page_ref()
+// Free a block returned by kalloc_pages(order).
+// The block is released when the reference count
+// of its first page drops to zero.
+void
+kfree_pages(void *pa, int order)
 {
-  ACQUIRE(&kpage_ref.lock);
+  if(order == 0) {
+    kfree(pa);
+    return;
+  }
+  if(order < 0 || order > KMEM_MAX_ORDER ||
+     ((uint64)pa - KERNBASE) % ORDER_BYTES(order) != 0 || !block_in_range((uint64)pa, order))
+    panic("kfree_pages");
+
+  int page_ref = put_page_ref((uint64)pa);
+  if (page_ref <= 0) {
+    printf("[warning] kfree_pages free block with ref <= 0\n");
+    return;
+  }
+
+  if (page_ref == 1) {
+    memset(pa, 1, ORDER_BYTES(order));
+    for(uint64 a = (uint64)pa; a < (uint64)pa + ORDER_BYTES(order); a += PGSIZE)
+      chg_page_ref(a, 0);
+    ACQUIRE(&kmem.lock);
+    buddy_free((uint64)pa, order);
+    RELEASE(&kmem.lock);
+  }
 }
 
-void 
-release_page_ref()
+// Bytes of free memory: the buddy lists plus the per-CPU caches.
+int 
+kmemleft()
 {
-  RELEASE(&kpage_ref.lock);
+  // a racy snapshot is fine for statistics, so no lock.
+  int n = kmem.nfree;
+
+  for (int i = 0; i < NCPU; i++)
+    n += kmem_pcp[i].count;
+  return n * PGSIZE;
 }
 
+// Sum the per-CPU page cache counters over all harts.
+void
+kmem_pcp_stat(uint64 *alloc_hit, uint64 *alloc_miss, uint64 *free_hit, uint64 *free_miss)
+{
+  *alloc_hit = *alloc_miss = *free_hit = *free_miss = 0;
+  for (int i = 0; i < NCPU; i++) {
+    *alloc_hit += kmem_pcp[i].alloc_hit;
+    *alloc_miss += kmem_pcp[i].alloc_miss;
+    *free_hit += kmem_pcp[i].free_hit;
+    *free_miss += kmem_pcp[i].free_miss;
+  }
+}
+
+// Add cnt to the reference count of the page holding addr.
 void 
 inc_page_ref(uint64 addr, int cnt)
 {
   if (addr < kmem.start || (uint64)addr >= PHYSTOP)
     return;
-  int idx = (PGROUNDDOWN(addr) - kmem.start) / PGSIZE;
-  int cur = kpage_ref.v[idx];
-  if (cnt > 0 && cur + cnt > 255) 
+  int ref = __atomic_add_fetch(&PA2KPAGE(addr)->ref, cnt, __ATOMIC_ACQ_REL);
+  if (cnt > 0 && ref <= 0) 
     panic("inc page_ref");
-  if (cnt < 0 && cur + cnt < 0)
+  if (cnt < 0 && ref < 0)
     panic("dec page_ref");
-  kpage_ref.v[idx] += cnt;
+}
+
+// Drop one reference to the page holding addr.
+// Returns the count before the drop; the caller that
+// sees 1 owns the page and must free it. A count that
+// was already <= 0 is left alone and returned as is.
+int
+put_page_ref(uint64 addr)
+{
+  if (addr < kmem.start || (uint64)addr >= PHYSTOP)
+    return 0;
+  uint *ref = &PA2KPAGE(addr)->ref;
+  uint old = __atomic_load_n(ref, __ATOMIC_ACQUIRE);
+  // compare and swap, so that no other hart ever sees the
+  // count below 0, not even for a moment.
+  do {
+    if ((int)old <= 0)
+      return old;
+  } while (!__atomic_compare_exchange_n(ref, &old, old - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  return old;
 }
 
 void 
@@ -171,13 +405,13 @@ chg_page_ref(uint64 addr, int to)
 {
   if (addr < kmem.start || (uint64)addr >= PHYSTOP)
     return;
-  int idx = (PGROUNDDOWN(addr) - kmem.start) / PGSIZE;
-  kpage_ref.v[idx] = to;
+  __atomic_store_n(&PA2KPAGE(addr)->ref, to, __ATOMIC_RELEASE);
 }
 
 int 
 get_page_ref(uint64 addr)
 {
-  int idx = (PGROUNDDOWN(addr) - kmem.start) / PGSIZE;
-  return kpage_ref.v[idx];
-}
\ No newline at end of file
+  if (addr < kmem.start || (uint64)addr >= PHYSTOP)
+    return 0;
+  return __atomic_load_n(&PA2KPAGE(addr)->ref, __ATOMIC_ACQUIRE);
+}
@@ -128,8 +128,9 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE-1){
       // this op might exhaust log space; wait for commit.
+      // one slot stays free for the superblock, see fslogsb().
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
@@ -164,6 +165,7 @@ end_op(void)
   if(do_commit){
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
+    fslogsb(log.dev);  // uses the log slot begin_op() leaves free
     commit();
     ACQUIRE(&log.lock);
     log.committing = 0;
@@ -217,7 +219,7 @@ log_write(struct block_buf *b)
   ACQUIRE(&log.lock);
   if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
     panic("too big a transaction");
-  if (log.outstanding < 1)
+  if (log.outstanding < 1 && !log.committing)
     panic("log_write outside of trans");
 
   for (i = 0; i < log.lh.n; i++) {
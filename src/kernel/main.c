@@ -12,9 +12,14 @@ main()
     printfinit();
     printf(ANSI_FMT("xv6 kernel is booting\n", ANSI_FG_CYAN));
     kinit();         // physical page allocator
+    slabinit();      // small object caches
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
+    timersinit();    // high-resolution timers
+    futexinit();     // futex wait queues
+    vdsoinit();      // clock page for user space
+    vmainit();       // shared zero page
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
@@ -22,6 +27,7 @@ main()
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipe cache
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
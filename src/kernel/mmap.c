@@ -0,0 +1,336 @@
+// Memory mappings made by mmap().
+//
+// A mapping is a region of the address space, see vma.c,
+// whose ops are mmapops. mmap() only records it; mmapfault()
+// fills in a page when it is first touched, with zeroes or
+// with the file's contents.
+// A private mapping gets a copy of the file, so what is
+// written to it stays in the process (and is copy-on-write
+// across fork()); a shared one is written back to the file
+// when it is unmapped, and fork() shares its pages.
+//
+// There is no page cache: two processes that map the same
+// file each read their own copy of it.
+
+#include "common/stdlib.h"
+#include "common/types.h"
+#include "kernel/param.h"
+#include "kernel/memlayout.h"
+#include "kernel/spinlock.h"
+#include "kernel/riscv.h"
+#include "kernel/proc.h"
+#include "kernel/defs.h"
+#include "kernel/fs.h"
+#include "kernel/sleeplock.h"
+#include "kernel/file.h"
+#include "kernel/fcntl.h"
+
+static int
+vmaperm(struct vma *v)
+{
+  int perm = PTE_U;
+
+  if(v->prot & PROT_READ)
+    perm |= PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_R | PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// Map len bytes of f from off, or zeroes if f is 0, at addr
+// if that is free and page-aligned, else wherever there is
+// room. Returns the address, or -1.
+uint64
+mmap(uint64 addr, uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct proc *g = myproc()->group;
+  struct vma *v;
+
+  if(len == 0 || len > MMAP_END - MMAP_BASE || off % PGSIZE != 0)
+    return -1;
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  if(f){
+    if(f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+  len = PGROUNDUP(len);
+  if(addr % PGSIZE != 0)
+    addr = 0;
+
+  ACQUIRE(&g->vmlock);
+  if((addr = vmaplace(g, addr, len)) == 0 ||
+     (v = vmainsert(g, addr, addr + len, prot, flags, &mmapops)) == 0){
+    RELEASE(&g->vmlock);
+    return -1;
+  }
+  v->f = f ? filedup(f) : 0;
+  v->off = off;
+  RELEASE(&g->vmlock);
+  return addr;
+}
+
+// Fill in the page at va of mapping v, with zeroes or from
+// its file, or copy it if it is copy-on-write. g->vmlock is
+// let go while the file is read. Returns 0, or -1 if the
+// access is not allowed or there is no memory.
+static int
+mmapfault(struct proc *g, struct vma *v, uint64 va, int access)
+{
+  struct file *f;
+  pte_t *pte;
+  uint64 off;
+  char *mem;
+
+  if(cowpage(g, va))
+    return uvmrealloc(g, PGROUNDDOWN(va));
+  va = PGROUNDDOWN(va);
+  if(access == PROT_READ)
+    access |= PROT_WRITE;   // a writable page is readable too
+  if(!(v->prot & access))
+    return -1;
+  // a mapped page faults only for an access it does not allow.
+  if((pte = walk(g->pagetable, va, 0)) != 0 && (*pte & PTE_V))
+    return -1;
+  // reading the file sleeps, which a fault in the kernel
+  // under a spinlock cannot; see vmaprefault().
+  if(v->f && mycpu()->noff > 1)
+    return -1;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+
+  if(v->f){
+    f = filedup(v->f);
+    off = v->off + (va - v->start);
+    RELEASE(&g->vmlock);
+    ilock(f->ip);
+    readi(f->ip, 0, (uint64)mem, off, PGSIZE);  // past the end stays zero
+    iunlock(f->ip);
+    fileclose(f);
+    ACQUIRE(&g->vmlock);
+    // another thread may have unmapped the region, or filled
+    // in the page, meanwhile. if the region is gone, the
+    // access faults again.
+    v = vmafind(g, va);
+    if(v == 0 || ((pte = walk(g->pagetable, va, 0)) != 0 && (*pte & PTE_V))){
+      kfree(mem);
+      return 0;
+    }
+  }
+
+  if(map_onepage(g->pagetable, va, (uint64)mem, vmaperm(v)) != 0){
+    kfree(mem);
+    return -1;
+  }
+  tlbflush(g, va, 1);
+  return 0;
+}
+
+struct vmaops mmapops = { "mapping", mmapfault };
+
+// Write the pages of [a, b) of shared file mapping m that
+// have been written to back to the file, but nothing past
+// its end.
+static void
+vmawriteback(struct proc *g, struct vma *m, uint64 a, uint64 b)
+{
+  // as many bytes as filewrite() writes in one transaction.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BLOCK_SIZE;
+  struct inode *ip;
+  pte_t *pte;
+  uint64 pa, off;
+  int i, n;
+
+  if(m->f == 0 || !(m->flags & MAP_SHARED) || !(m->prot & PROT_WRITE))
+    return;
+  ip = m->f->ip;
+  for(uint64 va = a; va < b; va += PGSIZE){
+    pa = 0;
+    ACQUIRE(&g->vmlock);
+    if((pte = walk(g->pagetable, va, 0)) != 0 && (*pte & PTE_V) && (*pte & PTE_D)){
+      pa = PTE2PA(*pte);
+      inc_page_ref(pa, 1);  // keep it while the lock is let go
+    }
+    RELEASE(&g->vmlock);
+    if(pa == 0)
+      continue;
+
+    off = m->off + (va - m->start);
+    for(i = 0; i < PGSIZE; i += n){
+      begin_op();
+      ilock(ip);
+      n = 0;
+      if(off + i < ip->size){
+        n = PGSIZE - i;
+        if(n > max)
+          n = max;
+        if(off + i + n > ip->size)
+          n = ip->size - (off + i);
+        n = writei(ip, 0, pa + i, off + i, n);
+      }
+      iunlock(ip);
+      end_op();
+      if(n <= 0)
+        break;
+    }
+    kfree((void*)pa);
+  }
+}
+
+// Unmap [addr, addr+len), which must lie within one mapping,
+// writing back what was written to a shared file mapping.
+// Returns 0, or -1.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *g = myproc()->group;
+  struct vma *v, *rest, m, r;
+  struct file *closef = 0;
+  uint64 end;
+
+  if(addr % PGSIZE != 0 || len == 0 || addr + len < addr)
+    return -1;
+  // rounding up can wrap to 0 as well.
+  end = PGROUNDUP(addr + len);
+  if(end <= addr)
+    return -1;
+
+  ACQUIRE(&g->vmlock);
+  if((v = vmafind(g, addr)) == 0 || v->ops != &mmapops || end > v->end){
+    RELEASE(&g->vmlock);
+    return -1;
+  }
+  m = *v;
+  if(m.f)
+    filedup(m.f);
+  RELEASE(&g->vmlock);
+
+  vmawriteback(g, &m, addr, end);
+
+  ACQUIRE(&g->vmlock);
+  // another thread may have changed the mappings meanwhile.
+  if((v = vmafind(g, addr)) == 0 || v->ops != &mmapops || end > v->end)
+    goto bad;
+  if(v->start < addr && end < v->end){
+    // a hole in the middle: the part above it is a region
+    // of its own.
+    if(g->nvma == NVMA)
+      goto bad;
+    r = *v;
+    v->end = addr;
+    rest = vmainsert(g, end, r.end, r.prot, r.flags, &mmapops);
+    rest->f = r.f ? filedup(r.f) : 0;
+    rest->off = r.off + (end - r.start);
+  } else if(v->start < addr){
+    v->end = addr;
+  } else if(end < v->end){
+    v->off += end - v->start;
+    v->start = end;
+  } else {
+    closef = v->f;
+    vmaremove(g, v);
+  }
+  upageunmap(g->pagetable, addr, (end - addr) / PGSIZE, 1);
+  tlbflush(g, addr, (end - addr) / PGSIZE);
+  RELEASE(&g->vmlock);
+
+  if(m.f)
+    fileclose(m.f);
+  if(closef)
+    fileclose(closef);
+  return 0;
+
+bad:
+  RELEASE(&g->vmlock);
+  if(m.f)
+    fileclose(m.f);
+  return -1;
+}
+
+// Unmap all of this process's mappings, as exit() and exec()
+// do. The process has no other threads.
+void
+munmapall(void)
+{
+  struct proc *g = myproc()->group;
+  struct vma *v;
+  uint64 start, end;
+
+  for(;;){
+    ACQUIRE(&g->vmlock);
+    for(v = g->vma; v < &g->vma[g->nvma] && v->ops != &mmapops; v++)
+      ;
+    if(v == &g->vma[g->nvma]){
+      RELEASE(&g->vmlock);
+      return;
+    }
+    start = v->start;
+    end = v->end;
+    RELEASE(&g->vmlock);
+    if(munmap(start, end - start) < 0)
+      return;
+  }
+}
+
+// Fill in every page of this process's shared mappings, as
+// fork() must before it copies them: a page not there yet
+// would be filled in later by the parent and by the child,
+// each with a page of its own. Returns 0, or -1 if out of
+// memory.
+int
+mmapfillshared(void)
+{
+  struct proc *g = myproc()->group;
+  struct vma *v;
+  uint64 start, len;
+
+  for(int i = 0; ; i++){
+    ACQUIRE(&g->vmlock);
+    if(i >= g->nvma){
+      RELEASE(&g->vmlock);
+      return 0;
+    }
+    v = &g->vma[i];
+    start = v->start;
+    len = 0;
+    if(v->ops == &mmapops && (v->flags & MAP_SHARED) && (v->prot & (PROT_READ|PROT_WRITE)))
+      len = v->end - v->start;
+    RELEASE(&g->vmlock);
+    if(len > 0 && vmapopulate(g, start, len) < 0)
+      return -1;
+  }
+}
+
+// Fill in the pages of [va, va+n) that lie in file mappings,
+// before read(), write() or wait4() copies to or from them:
+// pipes, the console and wait4() copy under a spinlock, and a
+// file under the lock of an inode that may be the mapped one,
+// when mmapfault() must be able to read the file.
+void
+vmaprefault(uint64 va, uint64 n)
+{
+  struct proc *g = myproc()->group;
+  uint64 a, b;
+  char c;
+
+  for(int i = 0; ; i++){
+    ACQUIRE(&g->vmlock);
+    if(i >= g->nvma){
+      RELEASE(&g->vmlock);
+      return;
+    }
+    a = g->vma[i].start > va ? g->vma[i].start : PGROUNDDOWN(va);
+    b = g->vma[i].end < va + n ? g->vma[i].end : va + n;
+    if(g->vma[i].f == 0)
+      b = a;
+    RELEASE(&g->vmlock);
+    // a fault on a page not yet there fills it in.
+    for(; a < b; a += PGSIZE)
+      copyin(&c, a, 1);
+  }
+}
@@ -324,7 +324,7 @@ addr2line(const char *lineinfo_file, uint64 addr)
  */
 void
 backtrace(int user, int lineinfo) {
-  uint64 fp, end;
+  uint64 fp, end, next;
   uint64 addr; 
   uint64 lastaddr = 0;
   char linefile[64] = "";
@@ -353,7 +353,14 @@ backtrace(int user, int lineinfo) {
   }
 
   while (fp != end) {
-    addr = *(uint64*)(fp - 8);
+    // a user frame pointer may point anywhere.
+    if (user && (copyin((char*)&addr, fp - 8, sizeof(addr)) < 0 ||
+                 copyin((char*)&next, fp - 16, sizeof(next)) < 0))
+      break;
+    if (!user) {
+      addr = *(uint64*)(fp - 8);
+      next = *(uint64*)(fp - 16);
+    }
     if (lastaddr != addr) {
       if (time != 0)
         printf("%d more times...\n", time);
@@ -365,7 +372,7 @@ backtrace(int user, int lineinfo) {
     } else {
       time++;
     }
-    fp = *(uint64*)(fp - 16);
+    fp = next;
     lastaddr = addr;
   }
 }
\ No newline at end of file
@@ -6,23 +6,64 @@
 #include "kernel/spinlock.h"
 #include "kernel/proc.h"
 #include "kernel/defs.h"
+#include "kernel/fcntl.h"
+#include "user/system.h"
 
 struct cpu cpus[NCPU];
 
 struct proc proc[NPROC];
 
-struct kpagetable_wrapper kpagetable_pool[NPROC / 2];
-struct spinlock kpool_lock;
-
 struct proc *initproc;
 
+// direct switches in a row before the scheduler gets a turn.
+#define NHANDOFF 8
+
+// Per-hart queues of RUNNABLE processes. A process is on a
+// queue exactly when it is RUNNABLE; both change together,
+// under p->lock and then the queue's lock. The scheduler
+// holds a queue lock when it wants a p->lock, so it only
+// tries for it, to keep that order deadlock-free.
+//
+// Each queue is a multi-level feedback queue: one list per
+// priority level, and a lower level runs only when all the
+// levels above it are empty. A process starts at its nice
+// level, drops a level each time it uses up a whole quantum,
+// and every BOOSTTICKS ticks all go back to their nice level,
+// so that nothing starves and a process that turns
+// interactive again gets its level back.
+struct runq {
+  struct spinlock lock;
+  struct {
+    struct proc *head;        // next to run
+    struct proc *tail;
+  } level[NPRIO];
+  int len;
+  uint boost;                 // boost generation last applied here
+} runqs[NCPU];
+
+// timer ticks a process may run for at a level.
+#define QUANTUM(level) (1 << (level))
+#define BOOSTTICKS 20
+#define BOOSTGEN() (ticks / BOOSTTICKS)
+
+// Sleeping processes, hashed by channel, so that wakeup()
+// only looks at the sleepers that might match. The links
+// and p->wq change under the queue's lock, and p->wq also
+// under p->lock; the queue lock comes first.
+#define NWAITQ 61
+#define WAITQ(chan) (&waitqs[((uint64)(chan) >> 3) % NWAITQ])
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitqs[NWAITQ];
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
 void freeproc(struct proc *p);
 
-extern char trampoline[]; // trampoline.S
 
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
@@ -38,21 +79,198 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  initlock(&kpool_lock, "kpool_lock");
   for(p = proc; p < &proc[NPROC]; p++) {
     char buf[10];
     sprintf(buf, "proc %d", (int)(p - proc));
     initlock(&p->lock, buf);
+    initlock(&p->vmlock, "vmlock");
     p->kstackbase = KSTACK((int) (p - proc));
     // this page is for kernel stack, which will not be freed while OS running.
     p->kstackpage = kalloc();
   }
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runqs[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitqs[i].lock, "waitq");
+}
+
+// Put p back at its nice level with a fresh quantum, if there
+// has been a boost since it last had one. Caller holds p->lock,
+// or p->rq->lock if p is queued.
+static void
+boostproc(struct proc *p, uint gen)
+{
+  if(p->boost == gen)
+    return;
+  p->boost = gen;
+  p->prio = p->nice;
+  p->used = 0;
+}
+
+// Queue p at the tail of its level. Caller holds rq->lock.
+static void
+runq_insert(struct runq *rq, struct proc *p)
+{
+  p->rq = rq;
+  p->rq_next = 0;
+  p->rq_prev = rq->level[p->prio].tail;
+  if(p->rq_prev)
+    p->rq_prev->rq_next = p;
+  else
+    rq->level[p->prio].head = p;
+  rq->level[p->prio].tail = p;
+  rq->len++;
+}
+
+// A hart other than this one that is idle, or -1.
+// Read without locks, so only a hint.
+static int
+idlehart(void)
+{
+  for(int i = 0; i < NCPU; i++)
+    if(i != cpuid() && cpus[i].started && cpus[i].idle)
+      return i;
+  return -1;
+}
+
+// Make p RUNNABLE and queue it on hart's run queue, or on
+// the one of the hart it last ran on if hart is -1. Then
+// interrupt the hart that should run it: that hart if it is
+// idle or runs something of a lower level, or an idle hart
+// to steal it if this one has more than it can run.
+// Caller holds p->lock.
+static void
+makerunnable(struct proc *p, int hart)
+{
+  struct runq *rq;
+  struct proc *running;
+  int kick = -1;
+
+  if(hart < 0)
+    hart = p->cpu;
+  rq = &runqs[hart];
+  p->state = RUNNABLE;
+  boostproc(p, BOOSTGEN());
+  ACQUIRE(&rq->lock);
+  runq_insert(rq, p);
+  // idle() sets c->idle under this lock, so either that hart
+  // sees p queued or we see it idle.
+  if(hart != cpuid()){
+    running = cpus[hart].proc;
+    if(cpus[hart].idle || (running && running->prio > p->prio))
+      kick = hart;
+  } else if(rq->len > 1 || (myproc() && p != myproc())){
+    kick = idlehart();
+  }
+  RELEASE(&rq->lock);
+  if(kick >= 0)
+    ipi(kick, IPI_RESCHED);
+}
+
+// Take p off its run queue. Caller holds p->lock and rq->lock.
+static void
+runq_remove(struct runq *rq, struct proc *p)
+{
+  if(p->rq_prev)
+    p->rq_prev->rq_next = p->rq_next;
+  else
+    rq->level[p->prio].head = p->rq_next;
+  if(p->rq_next)
+    p->rq_next->rq_prev = p->rq_prev;
+  else
+    rq->level[p->prio].tail = p->rq_prev;
+  p->rq = 0;
+  rq->len--;
+}
+
+// Apply boost generation gen to every process queued on rq.
+// The processes are not locked: while queued, their level
+// belongs to the queue lock.
+static void
+runq_boost(struct runq *rq, uint gen)
+{
+  struct proc *p, *next;
+
+  ACQUIRE(&rq->lock);
+  if(rq->boost != gen){
+    rq->boost = gen;
+    for(int l = 0; l < NPRIO; l++){
+      for(p = rq->level[l].head; p; p = next){
+        next = p->rq_next;
+        if(p->boost == gen || p->nice == l){
+          boostproc(p, gen);
+          continue;
+        }
+        // up to a level above l, so not seen again here.
+        runq_remove(rq, p);
+        boostproc(p, gen);
+        runq_insert(rq, p);
+      }
+    }
+  }
+  RELEASE(&rq->lock);
+}
+
+// Take the first process on rq whose lock is free, from the
+// highest level that has one: from the head, or from the tail
+// when stealing (the one that has waited least, so likely has
+// the least warm cache left). Returns it locked, or 0.
+static struct proc*
+runq_take(struct runq *rq, int steal)
+{
+  struct proc *p = 0;
+
+  if(rq->len == 0)
+    return 0;
+  ACQUIRE(&rq->lock);
+  for(int l = 0; l < NPRIO && p == 0; l++){
+    p = steal ? rq->level[l].tail : rq->level[l].head;
+    for(; p; p = steal ? p->rq_prev : p->rq_next){
+      if(tryacquire(&p->lock)){
+        runq_remove(rq, p);
+        break;
+      }
+    }
+  }
+  RELEASE(&rq->lock);
+  return p;
+}
 
-  for(int i = 0; i < NELEM(kpagetable_pool); i++) {
-    struct kpagetable_wrapper *kpw = &kpagetable_pool[i];
-    kpw->occupied = 0;
-    kpw->page = uclean_kpagetable();
+// Whether anything is queued on rq above level prio.
+// Read without the lock, so only a hint.
+static int
+runq_above(struct runq *rq, int prio)
+{
+  for(int l = 0; l < prio; l++)
+    if(rq->level[l].head)
+      return 1;
+  return 0;
+}
+
+// Find a process for hart to run: from its own queue,
+// else stolen from the longest other queue.
+// Returns it locked, or 0 if there is none.
+static struct proc*
+runq_next(int hart)
+{
+  struct proc *p;
+  int busiest = -1, max = 0;
+
+  if(runqs[hart].boost != BOOSTGEN())
+    runq_boost(&runqs[hart], BOOSTGEN());
+  if((p = runq_take(&runqs[hart], 0)) != 0)
+    return p;
+  // lengths are read without locks; a wrong guess only
+  // costs a failed attempt.
+  for(int i = 0; i < NCPU; i++){
+    if(i != hart && runqs[i].len > max){
+      max = runqs[i].len;
+      busiest = i;
+    }
   }
+  if(busiest < 0)
+    return 0;
+  return runq_take(&runqs[busiest], 1);
 }
 
 // Must be called with interrupts disabled,
@@ -96,13 +314,42 @@ allocpid() {
   return pid;
 }
 
+// Map thread p's trapframe and kernel stack into the page
+// table of its group g. Caller holds g->vmlock.
+static int
+proc_mapthread(struct proc *g, struct proc *p)
+{
+  if(mappages(g->pagetable, p->tfva, PGSIZE, (uint64)p->trapframe, PTE_R | PTE_W) < 0)
+    return -1;
+  if(mappages(g->pagetable, p->kstackbase, PGSIZE, (uint64)p->kstackpage, PTE_R | PTE_W) < 0){
+    upageunmap(g->pagetable, p->tfva, 1, 0);
+    return -1;
+  }
+  return 0;
+}
+
+// Take thread p's pages out of its group's page table.
+static void
+proc_unmapthread(struct proc *p)
+{
+  struct proc *g = p->group;
+
+  ACQUIRE(&g->vmlock);
+  upageunmap(g->pagetable, p->tfva, 1, 0);
+  upageunmap(g->pagetable, p->kstackbase, 1, 0);
+  tlbflush(g, 0, 0);
+  RELEASE(&g->vmlock);
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// and return with p->lock held. If g is not 0, the proc is a
+// thread in g's address space, see clone().
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(struct proc *g)
 {
+  int r;
   struct proc *p;
 
   for(p = proc; p < &proc[NPROC]; p++) {
@@ -119,6 +366,20 @@ found:
   p->pid = allocpid();
   p->state = USED;
   p->random_seed = ticks;
+  // the slot's old ASIDs may still be in some TLB.
+  p->asid = 0;
+  p->asid_gen = 0;
+  p->tlbstale = 0;
+  p->nice = 0;
+  p->prio = 0;
+  p->used = 0;
+  p->boost = BOOSTGEN();
+  p->nthreads = 0;
+  memset(&p->ru, 0, sizeof(p->ru));
+  memset(&p->cru, 0, sizeof(p->cru));
+  p->nvma = 0;
+  p->group = g ? g : p;
+  p->tfva = g ? THREADFRAME((int)(p - proc)) : TRAPFRAME;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -127,6 +388,20 @@ found:
     return NULL;
   }
 
+  if(g){
+    p->usyscall = g->usyscall;
+    p->pagetable = g->pagetable;
+    ACQUIRE(&g->vmlock);
+    r = proc_mapthread(g, p);
+    RELEASE(&g->vmlock);
+    if(r < 0){
+      freeproc(p);
+      RELEASE(&p->lock);
+      return NULL;
+    }
+    goto done;
+  }
+
   // Allocate a usyscall page.
   if((p->usyscall = (struct usyscall *)kalloc()) == 0){
     freeproc(p);
@@ -138,20 +413,15 @@ found:
     p->usyscall->cwd[1] = 0;
   }
 
-  // An empty user page table.
+  // A page table with no user memory.
   p->pagetable = proc_pagetable(p);
   if(p->pagetable == 0){
     freeproc(p);
     RELEASE(&p->lock);
     return NULL;
   } 
-  p->kpagetable = proc_kpagetable(p);
-  if(p->kpagetable == 0) {
-    freeproc(p);
-    RELEASE(&p->lock);
-    return NULL;
-  }
 
+done:
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -167,14 +437,20 @@ found:
 void
 freeproc(struct proc *p)
 {
+  if(p->group && p->group != p){
+    // a thread: the rest belongs to the group.
+    proc_unmapthread(p);
+    p->usyscall = 0;
+    p->pagetable = 0;
+  }
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
   if(p->usyscall)
     kfree((void*)p->usyscall);
   p->usyscall = 0;
-  proc_free_pagetable(p);
-  proc_free_kpagetable(p, 0);
+  proc_free_pagetable(p, 0);
+  p->group = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -185,162 +461,54 @@ freeproc(struct proc *p)
   addrinfo_clear(p->addrinfo);
 }
 
-// Create a user page table for a given process,
-// with no user memory, but with trampoline pages.
+// Create the page table of a given process, with no user
+// memory, but with its trapframe and kernel stack. The kernel
+// runs on it too, see kvmcreate(), and the trampoline comes
+// with the kernel map.
 pagetable_t
 proc_pagetable(struct proc *p)
 {
   pagetable_t pagetable;
-  // An empty page table.
-  pagetable = upagecreate();
-  if(pagetable == 0)
+
+  if((pagetable = kvmcreate()) == 0)
     return NULL;
-  // map the trampoline code (for system call return)
-  // at the highest user virtual address.
-  // only the supervisor uses it, on the way
-  // to/from user space, so not PTE_U.
-  if(mappages(pagetable, TRAMPOLINE, PGSIZE, (uint64)trampoline, PTE_R | PTE_X) < 0){
-    goto bad;
-  }
   // map the trapframe just below TRAMPOLINE, for trampoline.S.
-  if(mappages(pagetable, TRAPFRAME, PGSIZE, (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
-    goto bad;
-  }
-  if(mappages(pagetable, USYSCALL, PGSIZE, (uint64)(p->usyscall), PTE_R | PTE_U) < 0){
-    goto bad;
-  }
-  return pagetable;
-bad:
-  // free kpgtbl
-  free_pagetable(pagetable, 0);
-  return NULL;
-}
-
-// Create a user kpagetable for a given process,
-// with no user memory, but with trampoline pages.
-extern char etext[];  // kernel.ld sets this to end of kernel code.
-pagetable_t
-proc_kpagetable(struct proc *p)
-{
-  struct kpagetable_wrapper *kpw = NULL;
-
-  ACQUIRE(&kpool_lock);
-  int i;
-  for (i = 0; i < NELEM(kpagetable_pool); i++) {
-    if (!kpagetable_pool[i].occupied) {
-      kpw = &kpagetable_pool[i];
-      break;
-    }
-  }
-  if (i == NELEM(kpagetable_pool)) 
+  if(mappages(pagetable, TRAPFRAME, PGSIZE, (uint64)(p->trapframe), PTE_R | PTE_W) < 0)
     goto bad;
-  
-  // map the trapframe just below TRAMPOLINE, for trampoline.S.
-  if(mappages(kpw->page, TRAPFRAME, PGSIZE, (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
+  if(mappages(pagetable, USYSCALL, PGSIZE, (uint64)(p->usyscall), PTE_R | PTE_U) < 0)
     goto bad;
-  }
-  if(mappages(kpw->page, USYSCALL, PGSIZE, (uint64)(p->usyscall), PTE_R) < 0){
-    upageunmap(kpw->page, TRAPFRAME, 1, 0);
+  if(mappages(pagetable, VDSO, PGSIZE, (uint64)vdso, PTE_R | PTE_U) < 0)
     goto bad;
-  }
-  if(mappages(kpw->page, p->kstackbase, PGSIZE, (uint64)p->kstackpage, PTE_R | PTE_W) < 0){
-    upageunmap(kpw->page, TRAPFRAME, 1, 0);
-    upageunmap(kpw->page, USYSCALL, 1, 0);
+  if(mappages(pagetable, p->kstackbase, PGSIZE, (uint64)p->kstackpage, PTE_R | PTE_W) < 0)
     goto bad;
-  }
-  kpw->occupied = 1;
-  RELEASE(&kpool_lock);
-  return kpw->page;
+  return pagetable;
 bad:
-  RELEASE(&kpool_lock);
+  upageunmap(pagetable, TRAPFRAME, 1, 0);
+  upageunmap(pagetable, USYSCALL, 1, 0);
+  upageunmap(pagetable, VDSO, 1, 0);
+  kvmfree(pagetable);
   return NULL;
 }
 
-pagetable_t 
-uclean_kpagetable()
-{
-  pagetable_t kpgtbl;
-
-  kpgtbl = (pagetable_t) kalloc();
-  if (kpgtbl == 0) 
-    return NULL;
-  memset(kpgtbl, 0, PGSIZE);
-
-  // uart registers
-  if (mappages(kpgtbl, UART0, PGSIZE, UART0, PTE_R | PTE_W) != 0) {
-    goto bad;
-  }
-  // virtio mmio disk interface
-  if (mappages(kpgtbl, VIRTIO0, PGSIZE, VIRTIO0, PTE_R | PTE_W) != 0) {
-    goto bad;
-  }
-  // PLIC
-  if (mappages(kpgtbl, PLIC, 0x400000, PLIC, PTE_R | PTE_W) != 0) {
-    goto bad;
-  }
-  // map kernel text executable and read-only.
-  if (mappages(kpgtbl, KERNBASE, (uint64)etext-KERNBASE, KERNBASE, PTE_R | PTE_X) != 0) {
-    goto bad;
-  }
-  // map kernel data and the physical RAM we'll make use of.
-  if (mappages(kpgtbl, (uint64)etext, PHYSTOP-(uint64)etext, (uint64)etext, PTE_R | PTE_W) != 0) {
-    goto bad;
-  }
-  // map the trampoline for trap entry/exit to
-  // the highest virtual address in the kernel.
-  if (mappages(kpgtbl, TRAMPOLINE, PGSIZE, (uint64)trampoline, PTE_R | PTE_X) != 0) {
-    goto bad;
-  }
-  return kpgtbl;
-bad:
-  // free kpgtbl
-  free_pagetable(kpgtbl, 0);
-  return 0;
-}
-
+// Free p's page table and its user memory. If satp is not 0,
+// switch to it first: p's kernel stack is mapped in the table.
 void 
-proc_free_pagetable(struct proc *p)  
+proc_free_pagetable(struct proc *p, uint64 satp)  
 {
   if (!p->pagetable)
     return;
-  // also from proc memory
-  upageunmap(p->pagetable, PROC_CODE_BASE(p), PROC_CODE_PAGES(p), 1);
-  upageunmap(p->pagetable, PROC_STACK_BASE(p), PROC_STACK_PAGES(p), 1);
-  upageunmap(p->pagetable, PROC_HEAP_BASE(p), PROC_HEAP_PAGES(p), 1);
-  free_pagetable(p->pagetable, 0);
-  p->pagetable = 0;
-}
-
-void 
-proc_free_kpagetable(struct proc *p, uint64 satp)  
-{
-  if (!p->kpagetable)
-    return;
   if (satp != 0) {
     w_satp(satp);
     sfence_vma();
   }
-  upageunmap(p->kpagetable, PROC_CODE_BASE(p), PROC_CODE_PAGES(p), 0);
-  upageunmap(p->kpagetable, PROC_STACK_BASE(p), PROC_STACK_PAGES(p), 0);
-  upageunmap(p->kpagetable, PROC_HEAP_BASE(p), PROC_HEAP_PAGES(p), 0);
-  upageunmap(p->kpagetable, TRAPFRAME, 1, 0);
-  upageunmap(p->kpagetable, USYSCALL, 1, 0);
-  upageunmap(p->kpagetable, p->kstackbase, 1, 0);
-  free_pagetable(p->kpagetable, PGTBLFREE_JUST_NO_LEAF);
-
-  ACQUIRE(&kpool_lock);
-  int i;
-  for (i = 0; i < NELEM(kpagetable_pool); i++) {
-    if (kpagetable_pool[i].page == p->kpagetable) {
-      kpagetable_pool[i].occupied = 0;
-      break;
-    }
-  }
-  RELEASE(&kpool_lock);
-
-  if (i == NELEM(kpagetable_pool))
-    panic("can not find [kpagetable wrapper] while free kpagetable");
-  p->kpagetable = 0;
+  for (struct vma *v = p->vma; v < &p->vma[p->nvma]; v++)
+    upageunmap(p->pagetable, v->start, (v->end - v->start) / PGSIZE, 1);
+  upageunmap(p->pagetable, TRAPFRAME, 1, 0);
+  upageunmap(p->pagetable, USYSCALL, 1, 0);
+  upageunmap(p->pagetable, VDSO, 1, 0);
+  upageunmap(p->pagetable, p->kstackbase, 1, 0);
+  kvmfree(p->pagetable);
+  p->pagetable = 0;
 }
 
 
@@ -363,7 +531,7 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy init's instructions
@@ -372,13 +540,12 @@ userinit(void)
   mem = kalloc();
   memset(mem, 0, PGSIZE);
   mappages(p->pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
-  mappages(p->kpagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X);
-  chg_page_ref((uint64)mem, 2);
   memmove(mem, initcode, sizeof(initcode));
 
   p->addrinfo.vm_offset = 0;
   p->addrinfo.program_sz = sizeof(initcode);
   p->addrinfo.logical_stack_top = PGSIZE;
+  vmainsert(p, 0, PGSIZE, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_PRIVATE, &codeops);
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
@@ -387,33 +554,48 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  makerunnable(p, 0);
 
   RELEASE(&p->lock);
 }
 
-// Grow or shrink user heap memory by n bytes.
+// Grow or shrink user heap memory by n bytes, and set *old
+// to where the heap ended before.
 // Return 0 on success, -1 on failure.
 int
-growproc(int n)
+growproc(int n, uint64 *old)
 {
   uint64 heap_end;
-  struct proc *p = myproc();
+  struct proc *p = myproc()->group;
+  struct vma *heap;
+  int r = -1;
 
+  ACQUIRE(&p->vmlock);
   heap_end = p->addrinfo.heap_end;
+  if((heap = vmaheap(p)) == 0)
+    goto out;
   if(n > 0){
     if (heap_end + n > p->addrinfo.stack_bottom) 
-      return -1;
+      goto out;
+    // nor into a mapping.
+    if (PGROUNDUP(heap_end + n) > heap->end &&
+        vmaoverlap(p, heap->end, PGROUNDUP(heap_end + n) - heap->end))
+      goto out;
   } else if(n < 0){
     if (heap_end + n > heap_end || heap_end + n < p->addrinfo.heap_start) 
-      return -1;
+      goto out;
     if((PGROUNDUP(heap_end) != PGROUNDUP(heap_end + n)) && 
         uvmdealloc(p, heap_end, heap_end + n) == -1) {
-      return -1;
+      goto out;
     }
   }
   p->addrinfo.heap_end += n;
-  return 0;
+  heap->end = PGROUNDUP(p->addrinfo.heap_end);
+  *old = heap_end;
+  r = 0;
+out:
+  RELEASE(&p->vmlock);
+  return r;
 }
 
 // Create a new process, copying the parent.
@@ -424,19 +606,30 @@ fork(void)
   int i, pid;
   struct proc *np;
   struct proc *p = myproc();
+  struct proc *g = p->group;
+
+  // the child gets the pages of shared mappings as they are,
+  // so they must all be there. before allocproc(), which
+  // returns holding a spinlock: filling them in reads files.
+  if(mmapfillshared() < 0)
+    return -1;
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
 
   // Copy user memory from parent to child. Both table and memory.
-  if(uvmcopy(p, np) < 0){
+  // From a thread, that is the memory of the whole group.
+  ACQUIRE(&g->vmlock);
+  if(uvmcopy(g, np) < 0){
+    RELEASE(&g->vmlock);
     freeproc(np);
     RELEASE(&np->lock);
     return -1;
   }
-  np->addrinfo = p->addrinfo;
+  np->addrinfo = g->addrinfo;
+  RELEASE(&g->vmlock);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -445,16 +638,21 @@ fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
+  ACQUIRE(&g->lock);
   for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+    if(g->ofile[i])
+      np->ofile[i] = filedup(g->ofile[i]);
+  np->cwd = idup(g->cwd);
+  RELEASE(&g->lock);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   // 将trace_mask拷贝到子进程
   np->trace_mask = p->trace_mask;
 
+  // the child starts afresh at the parent's nice level.
+  np->nice = np->prio = p->nice;
+
   pid = np->pid;
 
   RELEASE(&np->lock);
@@ -464,7 +662,7 @@ fork(void)
   RELEASE(&wait_lock);
 
   ACQUIRE(&np->lock);
-  np->state = RUNNABLE;
+  makerunnable(np, cpuid());
   RELEASE(&np->lock);
 
   return pid;
@@ -485,9 +683,67 @@ reparent(struct proc *p)
   }
 }
 
+// Add to ru what p has used, and what the children it waited
+// for and its threads that are gone have.
+static void
+ruadd(struct rusage *ru, struct proc *p)
+{
+  struct rusage *from[] = { &p->ru, &p->cru };
+
+  for(int i = 0; i < NELEM(from); i++){
+    ru->utime += from[i]->utime;
+    ru->stime += from[i]->stime;
+    ru->rchar += from[i]->rchar;
+    ru->wchar += from[i]->wchar;
+    ru->minflt += from[i]->minflt;
+    ru->cowflt += from[i]->cowflt;
+    ru->zeroflt += from[i]->zeroflt;
+    ru->nvcsw += from[i]->nvcsw;
+    ru->nivcsw += from[i]->nivcsw;
+    ru->inblock += from[i]->inblock;
+    ru->oublock += from[i]->oublock;
+  }
+}
+
+// Kill the threads of group leader g, and free them as they
+// exit. Returns when all are gone.
+static void
+killthreads(struct proc *g)
+{
+  struct proc *pp;
+
+  ACQUIRE(&wait_lock);
+  while(g->nthreads > 0){
+    // a thread may clone another while we look, so again
+    // each time round.
+    for(pp = proc; pp < &proc[NPROC]; pp++){
+      if(pp == g)
+        continue;
+      ACQUIRE(&pp->lock);
+      if(pp->state != UNUSED && pp->group == g){
+        if(pp->state == ZOMBIE){
+          ruadd(&g->cru, pp);
+          freeproc(pp);
+          g->nthreads--;
+        } else {
+          pp->killed = 1;
+          if(pp->state == SLEEPING)
+            makerunnable(pp, -1);
+        }
+      }
+      RELEASE(&pp->lock);
+    }
+    if(g->nthreads > 0)
+      sleep(g, &wait_lock);
+  }
+  RELEASE(&wait_lock);
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
-// until its parent calls wait().
+// until its parent calls wait(). A thread exits alone
+// and waits for join(); a group leader takes its
+// threads down with it first.
 void
 exit(int status)
 {
@@ -496,27 +752,36 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
+  if(p->group == p){
+    // the threads run in our memory, so they go first.
+    killthreads(p);
+
+    // write back shared mappings while their files are open.
+    munmapall();
+
+    // Close all open files.
+    for(int fd = 0; fd < NOFILE; fd++){
+      if(p->ofile[fd]){
+        struct file *f = p->ofile[fd];
+        fileclose(f);
+        p->ofile[fd] = 0;
+      }
     }
-  }
 
-  begin_op();
-  iput(p->cwd);
-  end_op();
-  p->cwd = 0;
+    begin_op();
+    iput(p->cwd);
+    end_op();
+    p->cwd = 0;
+  }
 
   ACQUIRE(&wait_lock);
 
   // Give any children to init.
   reparent(p);
 
-  // Parent might be sleeping in wait().
-  wakeup(p->parent);
+  // Parent might be sleeping in wait(), or another
+  // thread in join() or killthreads().
+  wakeup(p->group == p ? p->parent : p->group);
   
   ACQUIRE(&p->lock);
 
@@ -534,18 +799,33 @@ exit(int status)
 // Return -1 if this process has no children.
 int
 wait(uint64 addr)
+{
+  return wait4(-1, addr, 0);
+}
+
+// Wait for the child process pid, or any if pid is -1, to
+// exit, and return its pid. Copies its exit status to addr
+// and its struct rusage to ruaddr, when these are not 0.
+// Return -1 if there is no such child.
+int
+wait4(int pid, uint64 addr, uint64 ruaddr)
 {
   struct proc *np;
-  int havekids, pid;
+  int havekids;
   struct proc *p = myproc();
+  struct rusage ru;
 
+  // the copies out are made under spinlocks, when a file
+  // mapping cannot be read in; see vmaprefault().
+  vmaprefault(addr, sizeof(int));
+  vmaprefault(ruaddr, sizeof(ru));
   ACQUIRE(&wait_lock);
 
   for(;;){
     // Scan through table looking for exited children.
     havekids = 0;
     for(np = proc; np < &proc[NPROC]; np++){
-      if(np->parent == p){
+      if(np->parent == p && (pid < 0 || np->pid == pid)){
         // make sure the child isn't still in exit() or swtch().
         ACQUIRE(&np->lock);
 
@@ -553,12 +833,18 @@ wait(uint64 addr)
         if(np->state == ZOMBIE){
           // Found one.
           pid = np->pid;
-          if(addr != 0 && copyout(0, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
+          memset(&ru, 0, sizeof(ru));
+          ruadd(&ru, np);
+          ru.utime /= TIMEBASE / 1000000;
+          ru.stime /= TIMEBASE / 1000000;
+          if((addr != 0 && copyout(0, addr, (char *)&np->xstate,
+                                   sizeof(np->xstate)) < 0) ||
+             (ruaddr != 0 && copyout(0, ruaddr, (char *)&ru, sizeof(ru)) < 0)) {
             RELEASE(&np->lock);
             RELEASE(&wait_lock);
             return -1;
           }
+          ruadd(&p->cru, np);
           freeproc(np);
           RELEASE(&np->lock);
           RELEASE(&wait_lock);
@@ -579,7 +865,124 @@ wait(uint64 addr)
   }
 }
 
+// Start a thread in the caller's address space, running fn(arg)
+// on the stack that ends at stack, with its own trapframe and
+// kernel stack but the open files and cwd of the group.
+// Returns its id, for join(), or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  struct proc *np;
+  struct proc *p = myproc();
+  struct proc *g = p->group;
+  int tid;
+
+  if((np = allocproc(g)) == 0)
+    return -1;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack & ~15;
+  np->trapframe->ra = 0;
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  np->trace_mask = p->trace_mask;
+  np->nice = np->prio = p->nice;
+
+  tid = np->pid;
+
+  RELEASE(&np->lock);
+
+  // counted before it runs, so that the leader's exit()
+  // waits for it too.
+  ACQUIRE(&wait_lock);
+  g->nthreads++;
+  RELEASE(&wait_lock);
+
+  ACQUIRE(&np->lock);
+  makerunnable(np, cpuid());
+  RELEASE(&np->lock);
+
+  return tid;
+}
+
+// Wait for thread tid of the caller's group to exit, and
+// free it. Copies its exit status to addr if not 0.
+// Returns tid, or -1 if there is no such thread.
+int
+join(int tid, uint64 addr)
+{
+  struct proc *pp;
+  struct proc *p = myproc();
+  struct proc *g = p->group;
+  int found;
+
+  vmaprefault(addr, sizeof(int));  // as in wait4()
+  ACQUIRE(&wait_lock);
+
+  for(;;){
+    found = 0;
+    for(pp = proc; pp < &proc[NPROC]; pp++){
+      if(pp == p || pp == g)
+        continue;
+      ACQUIRE(&pp->lock);
+      if(pp->state != UNUSED && pp->group == g && pp->pid == tid){
+        found = 1;
+        if(pp->state == ZOMBIE){
+          if(addr != 0 && copyout(0, addr, (char *)&pp->xstate,
+                                  sizeof(pp->xstate)) < 0) {
+            RELEASE(&pp->lock);
+            RELEASE(&wait_lock);
+            return -1;
+          }
+          ruadd(&g->cru, pp);
+          freeproc(pp);
+          g->nthreads--;
+          RELEASE(&pp->lock);
+          RELEASE(&wait_lock);
+          return tid;
+        }
+      }
+      RELEASE(&pp->lock);
+    }
+
+    if(!found || p->killed){
+      RELEASE(&wait_lock);
+      return -1;
+    }
+
+    // exiting threads wake up their leader.
+    sleep(g, &wait_lock);
+  }
+}
+
 // Per-CPU process scheduler.
+// Stall the hart until an interrupt, unless something has been
+// queued here since runq_next() looked. Once c->idle is set
+// under the queue lock, makerunnable() sends an IPI for
+// whatever it queues here. Called with interrupts off; the
+// interrupt that ends the wfi is taken when the scheduler
+// turns them back on.
+static void
+idle(struct cpu *c)
+{
+  struct runq *rq = &runqs[cpuid()];
+  uint64 start;
+  int n;
+
+  ACQUIRE(&rq->lock);
+  c->idle = 1;
+  n = rq->len;
+  RELEASE(&rq->lock);
+  if(n == 0){
+    start = r_time();
+    wfi();
+    c->idletime += r_time() - start;
+  }
+  c->idle = 0;
+}
+
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
 //  - choose a process to run.
@@ -594,31 +997,86 @@ scheduler(void)
   struct cpu *c = mycpu();
   
   c->proc = 0;
+  c->starttime = r_time();
+  c->started = 1;
   for(;;){
-    // Avoid deadlock by ensuring that devices can interrupt.
+    // Avoid deadlock by ensuring that devices can interrupt,
+    // then turn them off again, so that none comes between
+    // finding nothing to run and the wfi in idle().
     intr_on();
+    intr_off();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      ACQUIRE(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to RELEASE its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-
-        w_satp(MAKE_SATP((uint64)p->kpagetable));
-        sfence_vma();
-        swtch(&c->context, &p->context);
-        w_satp(MAKE_SATP((uint64)kernel_pagetable));
-        sfence_vma();
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      RELEASE(&p->lock);
+    if((p = runq_next(cpuid())) == 0){
+      idle(c);
+      continue;
     }
+    // Switch to chosen process.  It is the process's job
+    // to RELEASE its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = cpuid();
+    p->usyscall->hart = p->cpu;
+    c->proc = p;
+    c->next = 0;
+    c->nhandoff = 0;
+
+    kvmswitch(p);
+    swtch(&c->context, &p->context);
+    kvmswitch(0);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    // It may have switched to others directly; the one that
+    // came back is c->proc, and holds its own lock.
+    p = c->proc;
+    c->proc = 0;
+    RELEASE(&p->lock);
+  }
+}
+
+// Pick a process for p to switch to directly, skipping the
+// scheduler: the last one woken up on this hart, if it is
+// still runnable, its lock is free, and nothing of a higher
+// level waits here. Returns it locked, or
+// 0. Only NHANDOFF switches in a row go this way, so that the
+// scheduler still gets to run the others.
+static struct proc*
+handoff(struct cpu *c, struct proc *p)
+{
+  struct proc *q = c->next;
+  struct runq *rq;
+
+  c->next = 0;
+  if(q == 0 || q == p || c->nhandoff >= NHANDOFF)
+    return 0;
+  // try only: two harts might want each other's processes.
+  if(!tryacquire(&q->lock))
+    return 0;
+  if(q->state != RUNNABLE || runq_above(&runqs[cpuid()], q->prio)){
+    RELEASE(&q->lock);
+    return 0;
+  }
+  rq = q->rq;
+  ACQUIRE(&rq->lock);
+  runq_remove(rq, q);
+  RELEASE(&rq->lock);
+  c->nhandoff++;
+  return q;
+}
+
+// Called first thing by a process switched to: release the
+// process that switched to it directly, if that is how it
+// got here.
+static void
+finishswitch(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *prev = c->prev;
+
+  c->next = 0;
+  if(prev){
+    c->prev = 0;
+    RELEASE(&prev->lock);
   }
 }
 
@@ -634,6 +1092,8 @@ sched(void)
 {
   int intena;
   struct proc *p = myproc();
+  struct cpu *c = mycpu();
+  struct proc *q;
 
   if(!holding(&p->lock))
     panic("sched p->lock");
@@ -644,9 +1104,22 @@ sched(void)
   if(intr_get())
     panic("sched interruptible");
 
-  intena = mycpu()->intena;
-  swtch(&p->context, &mycpu()->context);
+  intena = c->intena;
+  p->ru.stime += r_time() - p->rustamp;
+  if((q = handoff(c, p)) != 0){
+    q->state = RUNNING;
+    q->cpu = cpuid();
+    q->usyscall->hart = q->cpu;
+    c->proc = q;
+    c->prev = p;
+    swtchsatp(&p->context, &q->context, kvmsatp(q));
+  } else {
+    swtch(&p->context, &c->context);
+  }
+  // maybe on another hart by now.
+  finishswitch();
   mycpu()->intena = intena;
+  p->rustamp = r_time();
 }
 
 // Give up the CPU for one scheduling round.
@@ -655,11 +1128,104 @@ yield(void)
 {
   struct proc *p = myproc();
   ACQUIRE(&p->lock);
-  p->state = RUNNABLE;
+  p->ru.nivcsw++;
+  makerunnable(p, cpuid());
   sched();
   RELEASE(&p->lock);
 }
 
+// Charge a timer tick to the running process, and give up the
+// CPU if that uses up its quantum, which also drops it a level,
+// or if something of a higher level waits on this hart.
+// Called with interrupts off.
+void
+schedtick(void)
+{
+  struct proc *p = myproc();
+  struct runq *rq = &runqs[cpuid()];
+  uint gen = BOOSTGEN();
+  int preempt;
+
+  if(rq->boost != gen)
+    runq_boost(rq, gen);
+  ACQUIRE(&p->lock);
+  boostproc(p, gen);
+  if(++p->used >= QUANTUM(p->prio)){
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    p->used = 0;
+    preempt = 1;
+  } else {
+    preempt = runq_above(rq, p->prio);
+  }
+  if(preempt){
+    p->ru.nivcsw++;
+    makerunnable(p, cpuid());
+    sched();
+  }
+  RELEASE(&p->lock);
+}
+
+// Set the nice level of process p, and move it there right
+// away. Caller holds p->lock.
+static void
+setnice(struct proc *p, int level)
+{
+  struct runq *rq = p->rq;
+
+  if(level < 0)
+    level = 0;
+  if(level > NPRIO-1)
+    level = NPRIO-1;
+  p->nice = level;
+  if(p->state == RUNNABLE){
+    ACQUIRE(&rq->lock);
+    runq_remove(rq, p);
+    p->prio = level;
+    p->used = 0;
+    runq_insert(rq, p);
+    RELEASE(&rq->lock);
+  } else {
+    p->prio = level;
+    p->used = 0;
+  }
+}
+
+// Add inc to the caller's nice level.
+// Returns the new level.
+int
+nice(int inc)
+{
+  struct proc *p = myproc();
+  int n;
+
+  ACQUIRE(&p->lock);
+  setnice(p, p->nice + inc);
+  n = p->nice;
+  RELEASE(&p->lock);
+  return n;
+}
+
+// Set the nice level of the process with the given pid.
+int
+setpriority(int pid, int level)
+{
+  struct proc *p;
+
+  if(level < 0 || level >= NPRIO)
+    return -1;
+  for(p = proc; p < &proc[NPROC]; p++){
+    ACQUIRE(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      setnice(p, level);
+      RELEASE(&p->lock);
+      return 0;
+    }
+    RELEASE(&p->lock);
+  }
+  return -1;
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
@@ -667,7 +1233,10 @@ forkret(void)
 {
   static int first = 1;
 
-  // Still holding p->lock from scheduler.
+  // Still holding p->lock from scheduler, or from
+  // the process that switched here directly.
+  finishswitch();
+  myproc()->rustamp = r_time();
   RELEASE(&myproc()->lock);
 
   if (first) {
@@ -682,6 +1251,19 @@ forkret(void)
   usertrapret();
 }
 
+// Take p off wq. Caller holds wq->lock.
+static void
+waitq_remove(struct waitq *wq, struct proc *p)
+{
+  if(p->wq_prev)
+    p->wq_prev->wq_next = p->wq_next;
+  else
+    wq->head = p->wq_next;
+  if(p->wq_next)
+    p->wq_next->wq_prev = p->wq_prev;
+  p->wq = 0;
+}
+
 // Atomically RELEASE lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -689,19 +1271,30 @@ sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
   
+  struct waitq *wq = WAITQ(chan);
+  
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we are on the wait queue, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the wait queue, then p->lock),
   // so it's okay to RELEASE lk.
 
+  ACQUIRE(&wq->lock);
   ACQUIRE(&p->lock);  //DOC: sleeplock1
   RELEASE(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->ru.nvcsw++;
+  p->wq = wq;
+  p->wq_prev = 0;
+  p->wq_next = wq->head;
+  if(wq->head)
+    wq->head->wq_prev = p;
+  wq->head = p;
+  RELEASE(&wq->lock);
 
   sched();
 
@@ -710,6 +1303,14 @@ sleep(void *chan, struct spinlock *lk)
 
   // Reacquire original lock.
   RELEASE(&p->lock);
+  // wakeup() unlinks us, but kill() cannot take the
+  // queue lock, so we may still be on it.
+  if(p->wq){
+    ACQUIRE(&wq->lock);
+    if(p->wq)
+      waitq_remove(wq, p);
+    RELEASE(&wq->lock);
+  }
   acquire(lk);
 }
 
@@ -718,17 +1319,27 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct waitq *wq = WAITQ(chan);
+  struct proc *p, *next;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      ACQUIRE(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+  ACQUIRE(&wq->lock);
+  for(p = wq->head; p; p = next) {
+    next = p->wq_next;
+    if(p->chan != chan || p == myproc())
+      continue;
+    ACQUIRE(&p->lock);
+    if(p->chan == chan) {
+      waitq_remove(wq, p);
+      // killed sleepers are already runnable.
+      if(p->state == SLEEPING) {
+        makerunnable(p, -1);
+        // a good bet for the next to run here.
+        mycpu()->next = p;
       }
-      RELEASE(&p->lock);
     }
+    RELEASE(&p->lock);
   }
+  RELEASE(&wq->lock);
 }
 
 // Kill the process with the given pid.
@@ -745,7 +1356,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        makerunnable(p, -1);
       }
       RELEASE(&p->lock);
       return 0;
@@ -783,19 +1394,21 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
   }
 }
 
+static char *states[] = {
+[UNUSED]    = "unused",
+[USED]      = "used  ",
+[SLEEPING]  = "sleep ",
+[RUNNABLE]  = "runble",
+[RUNNING]   = "run   ",
+[ZOMBIE]    = "zombie"
+};
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
 void
 procdump(void)
 {
-  static char *states[] = {
-  [UNUSED]    = "unused",
-  [SLEEPING]  = "sleep ",
-  [RUNNABLE]  = "runble",
-  [RUNNING]   = "run   ",
-  [ZOMBIE]    = "zombie"
-  };
   struct proc *p;
   char *state;
 
@@ -822,3 +1435,87 @@ procdump(void)
     printf("\n");
   }
 }
+
+// Copy a struct procinfo for each process in use, at most n,
+// to user address addr. Returns how many, or -1.
+int
+procinfo(uint64 addr, int n)
+{
+  struct procinfo pi;
+  struct proc *p;
+  int i = 0;
+
+  for(p = proc; p < &proc[NPROC] && i < n; p++){
+    ACQUIRE(&p->lock);
+    if(p->state == UNUSED){
+      RELEASE(&p->lock);
+      continue;
+    }
+    pi.pid = p->pid;
+    safestrcpy(pi.state, states[p->state], sizeof(pi.state));
+    pi.prio = p->prio;
+    pi.nice = p->nice;
+    safestrcpy(pi.name, p->name, sizeof(pi.name));
+    RELEASE(&p->lock);
+    if(copyout(0, addr + i * sizeof(pi), (char*)&pi, sizeof(pi)) < 0)
+      return -1;
+    i++;
+  }
+  return i;
+}
+
+// Processes running or waiting to run, for the load average.
+// Read without locks.
+int
+nrunnable(void)
+{
+  int n = 0;
+
+  for(int i = 0; i < NCPU; i++)
+    n += runqs[i].len + (cpus[i].proc != 0);
+  return n;
+}
+
+// Idle and busy time of hart so far, in r_time() cycles.
+// Returns -1 if the hart has not started.
+int
+cpustat(int hart, uint64 *idle, uint64 *busy)
+{
+  struct cpu *c;
+
+  if(hart < 0 || hart >= NCPU || !(c = &cpus[hart])->started)
+    return -1;
+  *idle = c->idletime;
+  *busy = r_time() - c->starttime - *idle;
+  return 0;
+}
+
+// Send hart an IPI asking for what (IPI_* bits), through the
+// CLINT; timervec passes it on as a supervisor software
+// interrupt, and devintr() picks up the bits with ipirecv().
+void
+ipi(int hart, int what)
+{
+  __atomic_fetch_or(&cpus[hart].ipi, what, __ATOMIC_RELEASE);
+  __sync_synchronize();
+  *(volatile uint32*)CLINT_MSIP(hart) = 1;
+}
+
+// Take the IPI_* bits sent to this hart since the last call.
+// Called with interrupts off.
+int
+ipirecv(void)
+{
+  return __atomic_exchange_n(&mycpu()->ipi, 0, __ATOMIC_ACQUIRE);
+}
+
+// For IPI_RESCHED: give up the CPU if something of a higher
+// level than the running process has been queued here.
+void
+preempt(void)
+{
+  struct proc *p = myproc();
+
+  if(runq_above(&runqs[cpuid()], p->prio))
+    yield();
+}
@@ -0,0 +1,236 @@
+// Slab allocator for small kernel objects.
+//
+// A cache hands out objects of one fixed size. Objects are
+// carved out of whole pages from kalloc() ("slabs"); each
+// slab starts with a struct slab header followed by as many
+// objects as fit. The slab of an object is found by rounding
+// its address down to the page, so kmem_cache_free() is O(1).
+//
+// In front of the slabs every hart keeps a small magazine of
+// free objects, used with interrupts off and no lock. Only
+// when a magazine runs empty or full does the hart take the
+// cache lock and move SLAB_PCP_BATCH objects at once.
+//
+// A slab whose objects are all free is given back to kalloc(),
+// so memory use follows the number of live objects.
+
+#include "common/types.h"
+#include "common/stdlib.h"
+#include "kernel/param.h"
+#include "kernel/spinlock.h"
+#include "kernel/riscv.h"
+#include "kernel/defs.h"
+
+#define NSLABCACHE     16
+#define SLAB_PCP_MAX   16
+#define SLAB_PCP_BATCH 8
+
+struct slab {
+  struct slab *next;        // on the cache's partial or full list
+  struct slab *prev;
+  struct kmem_cache *cache;
+  void *freelist;           // free objects in this slab
+  int inuse;                // objects handed out
+};
+
+// a free object holds the link to the next free object.
+struct slab_obj {
+  struct slab_obj *next;
+};
+
+struct slab_pcp {
+  void *objs[SLAB_PCP_MAX];
+  int count;
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char name[16];
+  uint size;                // object size, multiple of 8
+  int perslab;              // objects per slab
+  struct slab partial;      // slabs with free objects
+  struct slab full;         // slabs with none
+  int nslab;
+  int nobj;                 // objects handed out of slabs
+  struct slab_pcp pcp[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NSLABCACHE];
+  int n;
+} slabs;
+
+static void
+slab_push(struct slab *head, struct slab *s)
+{
+  s->next = head->next;
+  s->prev = head;
+  head->next->prev = s;
+  head->next = s;
+}
+
+static void
+slab_remove(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+void
+slabinit(void)
+{
+  initlock(&slabs.lock, "slabs");
+}
+
+// Create a cache of objects of size bytes.
+// name is for debugging. Panics if out of caches or
+// if an object would not fit in a page.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c = 0;
+
+  size = (size + 7) & ~7;
+  if(size < sizeof(struct slab_obj) || size > PGSIZE - sizeof(struct slab))
+    panic("kmem_cache_create: size");
+
+  // not panic() with the lock held.
+  ACQUIRE(&slabs.lock);
+  if(slabs.n < NSLABCACHE)
+    c = &slabs.cache[slabs.n++];
+  RELEASE(&slabs.lock);
+  if(c == 0)
+    panic("kmem_cache_create: too many caches");
+
+  initlock(&c->lock, name);
+  safestrcpy(c->name, name, sizeof(c->name));
+  c->size = size;
+  c->perslab = (PGSIZE - sizeof(struct slab)) / size;
+  c->partial.next = c->partial.prev = &c->partial;
+  c->full.next = c->full.prev = &c->full;
+  return c;
+}
+
+// Get a fresh slab page for c. Caller must hold c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->freelist = 0;
+  obj = (char*)s + PGSIZE - c->perslab * c->size;
+  for(int i = 0; i < c->perslab; i++, obj += c->size) {
+    ((struct slab_obj*)obj)->next = s->freelist;
+    s->freelist = obj;
+  }
+  slab_push(&c->partial, s);
+  c->nslab++;
+  return s;
+}
+
+// Move up to SLAB_PCP_BATCH objects from the slabs into pcp.
+static void
+pcp_refill(struct kmem_cache *c, struct slab_pcp *pcp)
+{
+  struct slab *s;
+  struct slab_obj *o;
+
+  ACQUIRE(&c->lock);
+  while(pcp->count < SLAB_PCP_BATCH) {
+    s = c->partial.next;
+    if(s == &c->partial && (s = slab_grow(c)) == 0)
+      break;
+    o = s->freelist;
+    s->freelist = o->next;
+    s->inuse++;
+    c->nobj++;
+    if(s->freelist == 0) {
+      slab_remove(s);
+      slab_push(&c->full, s);
+    }
+    pcp->objs[pcp->count++] = o;
+  }
+  RELEASE(&c->lock);
+}
+
+// Return obj to its slab. Caller must hold c->lock.
+static void
+slab_put(struct kmem_cache *c, void *obj)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)obj);
+  struct slab_obj *o = obj;
+
+  if(s->cache != c)
+    panic("kmem_cache_free: %s: wrong cache", c->name);
+  if(s->freelist == 0) {
+    slab_remove(s);
+    slab_push(&c->partial, s);
+  }
+  o->next = s->freelist;
+  s->freelist = o;
+  s->inuse--;
+  c->nobj--;
+  if(s->inuse == 0) {
+    slab_remove(s);
+    c->nslab--;
+    kfree(s);
+  }
+}
+
+// Give SLAB_PCP_BATCH objects of pcp back to their slabs.
+static void
+pcp_drain(struct kmem_cache *c, struct slab_pcp *pcp)
+{
+  ACQUIRE(&c->lock);
+  for(int i = 0; i < SLAB_PCP_BATCH && pcp->count > 0; i++)
+    slab_put(c, pcp->objs[--pcp->count]);
+  RELEASE(&c->lock);
+}
+
+// Allocate one object from c.
+// Returns 0 if out of memory. The object is not zeroed.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct slab_pcp *pcp;
+  void *obj = 0;
+
+  push_off();
+  pcp = &c->pcp[cpuid()];
+  if(pcp->count == 0)
+    pcp_refill(c, pcp);
+  if(pcp->count > 0)
+    obj = pcp->objs[--pcp->count];
+  pop_off();
+  return obj;
+}
+
+// Free an object returned by kmem_cache_alloc(c).
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct slab_pcp *pcp;
+
+  push_off();
+  pcp = &c->pcp[cpuid()];
+  if(pcp->count >= SLAB_PCP_MAX)
+    pcp_drain(c, pcp);
+  pcp->objs[pcp->count++] = obj;
+  pop_off();
+}
+
+// Print every cache, for the ^S console dump.
+void
+kmem_cache_dump(void)
+{
+  for(int i = 0; i < slabs.n; i++) {
+    struct kmem_cache *c = &slabs.cache[i];
+    printf("slab %s: size %d, %d objs in %d slabs\n", c->name, c->size, c->nobj, c->nslab);
+  }
+}
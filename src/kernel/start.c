@@ -10,7 +10,7 @@ void timerinit();
 __attribute__ ((aligned (16))) char stack0[2 * PGSIZE * NCPU];
 
 // a scratch area per CPU for machine-mode timer interrupts.
-uint64 timer_scratch[NCPU][5];
+uint64 timer_scratch[NCPU][9];
 
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
@@ -42,6 +42,10 @@ start()
   w_pmpaddr0(0x3fffffffffffffull);
   w_pmpcfg0(0xf);
 
+  // let supervisor mode read the time CSR, for the
+  // per-hart idle and busy accounting.
+  w_mcounteren(r_mcounteren() | 2);
+
   // ask for clock interrupts.
   timerinit();
 
@@ -64,16 +68,24 @@ timerinit()
   int id = r_mhartid();
 
   // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
-  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
+  int interval = TICKCYCLES;
+  uint64 next = *(uint64*)CLINT_MTIME + interval;
+  *(uint64*)CLINT_MTIMECMP(id) = next;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..2] : space for timervec to save registers.
   // scratch[3] : address of CLINT MTIMECMP register.
   // scratch[4] : desired interval (in cycles) between timer interrupts.
+  // scratch[5] : set by timervec when a tick is due.
+  // scratch[6] : address of CLINT MSIP register, for IPIs.
+  // scratch[7] : time of the next tick.
+  // scratch[8] : earliest timer deadline, see timerset().
   uint64 *scratch = &timer_scratch[id][0];
   scratch[3] = CLINT_MTIMECMP(id);
   scratch[4] = interval;
+  scratch[6] = CLINT_MSIP(id);
+  scratch[7] = next;
+  scratch[8] = ~0ULL;
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -82,6 +94,37 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode timer and software interrupts.
+  w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
+}
+
+// Whether a tick has been due on this hart since the last
+// call. For devintr(), in supervisor mode: timervec raises
+// the same software interrupt for ticks, timer deadlines
+// and IPIs.
+int
+timerfired()
+{
+  return __atomic_exchange_n(&timer_scratch[r_tp()][5], 0, __ATOMIC_RELAXED) != 0;
+}
+
+// Ask for a timer interrupt on this hart at time when, in
+// r_time() cycles, besides the ticks; ~0 for none. For
+// timer.c, in supervisor mode, with interrupts off.
+// timervec may run between any two lines here, but the
+// value written to MTIMECMP can only be too early, which
+// costs a spurious interrupt after which timervec writes
+// the right one.
+void
+timerset(uint64 when)
+{
+  volatile uint64 *scratch = timer_scratch[r_tp()];
+  uint64 next;
+
+  scratch[8] = when;
+  __sync_synchronize();
+  next = scratch[7];
+  if(when < next)
+    next = when;
+  *(volatile uint64*)CLINT_MTIMECMP(r_tp()) = next;
 }
@@ -334,14 +334,14 @@ trace_uptime()
 	return "";
 }
 
-// int trace(int);
+// int trace(uint64);
 const char*
 trace_trace()
 {
 	static char buf[32];
-	int a;
-	argint(0, &a);
-	snprintf(buf, sizeof(buf), "%d", a);
+	uint64 a;
+	argaddr(0, &a);
+	snprintf(buf, sizeof(buf), "0x%lx", a);
 	return buf;
 }
 
@@ -357,4 +357,160 @@ const char*
 trace_system_info()
 {
 	return "";
-}
\ No newline at end of file
+}
+
+// int nice(int);
+const char*
+trace_nice()
+{
+	static char buf[32];
+	int a;
+	argint(0, &a);
+	snprintf(buf, sizeof(buf), "%d", a);
+	return buf;
+}
+
+// int setpriority(int, int);
+const char*
+trace_setpriority()
+{
+	static char buf[32];
+	int a, b;
+	argint(0, &a);
+	argint(1, &b);
+	snprintf(buf, sizeof(buf), "%d, %d", a, b);
+	return buf;
+}
+
+// int getprocs(struct procinfo*, int);
+const char*
+trace_getprocs()
+{
+	static char buf[32];
+	uint64 a;
+	int b;
+	argaddr(0, &a);
+	argint(1, &b);
+	snprintf(buf, sizeof(buf), "0x%lx, %d", a, b);
+	return buf;
+}
+
+// int nanosleep(uint64);
+const char*
+trace_nanosleep()
+{
+	static char buf[32];
+	uint64 a;
+	argaddr(0, &a);
+	snprintf(buf, sizeof(buf), "%ld", a);
+	return buf;
+}
+
+// int clone(void (*)(void*), void*, void*);
+const char*
+trace_clone()
+{
+	static char buf[64];
+	uint64 a, b, c;
+	argaddr(0, &a);
+	argaddr(1, &b);
+	argaddr(2, &c);
+	snprintf(buf, sizeof(buf), "0x%lx, 0x%lx, 0x%lx", a, b, c);
+	return buf;
+}
+
+// int join(int, int*);
+const char*
+trace_join()
+{
+	static char buf[32];
+	int a;
+	uint64 b;
+	argint(0, &a);
+	argaddr(1, &b);
+	snprintf(buf, sizeof(buf), "%d, 0x%lx", a, b);
+	return buf;
+}
+
+// int futex_wait(uint*, uint);
+const char*
+trace_futex_wait()
+{
+	static char buf[32];
+	uint64 a;
+	int b;
+	argaddr(0, &a);
+	argint(1, &b);
+	snprintf(buf, sizeof(buf), "0x%lx, %d", a, b);
+	return buf;
+}
+
+// int futex_wake(uint*, int);
+const char*
+trace_futex_wake()
+{
+	static char buf[32];
+	uint64 a;
+	int b;
+	argaddr(0, &a);
+	argint(1, &b);
+	snprintf(buf, sizeof(buf), "0x%lx, %d", a, b);
+	return buf;
+}
+
+// int wait4(int, int*, struct rusage*);
+const char*
+trace_wait4()
+{
+	static char buf[64];
+	int a;
+	uint64 b, c;
+	argint(0, &a);
+	argaddr(1, &b);
+	argaddr(2, &c);
+	snprintf(buf, sizeof(buf), "%d, 0x%lx, 0x%lx", a, b, c);
+	return buf;
+}
+
+// void* mmap(void*, uint64, int, int, int, uint64);
+const char*
+trace_mmap()
+{
+	static char buf[96];
+	uint64 a, b, f;
+	int c, d, e;
+	argaddr(0, &a);
+	argaddr(1, &b);
+	argint(2, &c);
+	argint(3, &d);
+	argint(4, &e);
+	argaddr(5, &f);
+	snprintf(buf, sizeof(buf), "0x%lx, %ld, 0x%x, 0x%x, %d, %ld", a, b, c, d, e, f);
+	return buf;
+}
+
+// int munmap(void*, uint64);
+const char*
+trace_munmap()
+{
+	static char buf[64];
+	uint64 a, b;
+	argaddr(0, &a);
+	argaddr(1, &b);
+	snprintf(buf, sizeof(buf), "0x%lx, %ld", a, b);
+	return buf;
+}
+
+// int madvise(void*, uint64, int);
+const char*
+trace_madvise()
+{
+	static char buf[64];
+	uint64 a, b;
+	int c;
+	argaddr(0, &a);
+	argaddr(1, &b);
+	argint(2, &c);
+	snprintf(buf, sizeof(buf), "0x%lx, %ld, %d", a, b, c);
+	return buf;
+}
@@ -8,9 +8,6 @@
 int
 fetchaddr(uint64 addr, uint64 *ip)
 {
-  struct proc *p = myproc();
-  if(!uaddrvalid(p, addr) || !uaddrvalid(p, addr + 7))
-    return -1;
   if(copyin((char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
   return 0;
@@ -21,9 +18,6 @@ fetchaddr(uint64 addr, uint64 *ip)
 int
 fetchstr(uint64 addr, char *buf, int max)
 {
-  struct proc *p = myproc();
-  if(!uaddrvalid(p, addr))
-    return -1;
   int err = copyinstr(buf, addr, max);
   if(err < 0)
     return err;
@@ -113,7 +107,7 @@ syscall(void)
   num = p->trapframe->a7; 
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     uint64 ret = syscalls[num](); 
-    if ((1 << num) & p->trace_mask) {
+    if ((1L << num) & p->trace_mask) {
       printf(ANSI_FMT("%s(%d): %s(%s) -> %d\n", ANSI_FG_CYAN), 
         p->name, p->pid, syscalls_name[num], strace_param[num](), ret);
     }
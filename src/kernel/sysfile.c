@@ -26,7 +26,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE || (f=myproc()->group->ofile[fd]) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -41,14 +41,17 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct proc *p = myproc()->group;
 
+  ACQUIRE(&p->lock);
   for(fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd] == 0){
       p->ofile[fd] = f;
+      RELEASE(&p->lock);
       return fd;
     }
   }
+  RELEASE(&p->lock);
   return -1;
 }
 
@@ -75,7 +78,11 @@ sys_read(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
     return -1;
-  return fileread(f, p, n);
+  if(n > 0)
+    vmaprefault(p, n);
+  if((n = fileread(f, p, n)) > 0)
+    myproc()->ru.rchar += n;
+  return n;
 }
 
 uint64
@@ -88,7 +95,11 @@ sys_write(void)
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
     return -1;
 
-  return filewrite(f, p, n);
+  if(n > 0)
+    vmaprefault(p, n);
+  if((n = filewrite(f, p, n)) > 0)
+    myproc()->ru.wchar += n;
+  return n;
 }
 
 uint64
@@ -97,9 +108,18 @@ sys_close(void)
   int fd;
   struct file *f;
 
+  struct proc *p = myproc()->group;
+
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  // another thread may be closing it too.
+  ACQUIRE(&p->lock);
+  if(p->ofile[fd] != f){
+    RELEASE(&p->lock);
+    return -1;
+  }
+  p->ofile[fd] = 0;
+  RELEASE(&p->lock);
   fileclose(f);
   return 0;
 }
@@ -392,8 +412,8 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
-  struct proc *p = myproc();
+  struct inode *ip, *old;
+  struct proc *p = myproc()->group;
   
   begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
@@ -407,11 +427,15 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
+  // threads look at the group's cwd in namex().
+  ACQUIRE(&p->lock);
+  old = p->cwd;
+  p->cwd = ip;
+  RELEASE(&p->lock);
+  iput(old);
   end_op();
 
   chdir(p->usyscall->cwd, path);
-  p->cwd = ip;
   return 0;
 }
 
@@ -463,7 +487,7 @@ sys_pipe(void)
   uint64 fdarray; // user pointer to array of two integers
   struct file *rf, *wf;
   int fd0, fd1;
-  struct proc *p = myproc();
+  struct proc *p = myproc()->group;
 
   if(argaddr(0, &fdarray) < 0)
     return -1;
@@ -488,6 +512,31 @@ sys_pipe(void)
   return 0;
 }
 
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len, off;
+  int prot, flags;
+  struct file *f = 0;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argaddr(5, &off) < 0)
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  return mmap(addr, len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
 static void 
 normalizePath(char *path) {
   // 分割路径，并处理"."和".."。
@@ -1,3 +1,4 @@
+#include "kernel/param.h"
 #include "kernel/riscv.h"
 #include "kernel/defs.h"
 #include "user/system.h"
@@ -6,7 +7,20 @@ void
 sysinfo_dump()
 {
 	// printf("\nsysinfo: %d page | %d block\n", kmemleft()/PGSIZE, diskleft());
+	uint64 ah, am, fh, fm;
 	printf("\nsysinfo: %d page\n", kmemleft()/PGSIZE);
+	kmem_pcp_stat(&ah, &am, &fh, &fm);
+	printf("pcp: kalloc %ld hit %ld miss | kfree %ld hit %ld miss\n", ah, am, fh, fm);
+	kmem_cache_dump();
+	for (int i = 0; i < NCPU; i++) {
+		uint64 idle, busy;
+		if (cpustat(i, &idle, &busy) < 0)
+			continue;
+		printf("hart %d: %ld idle %ld busy", i, idle, busy);
+		if (idle + busy > 0)
+			printf(" (%ld%% busy)", busy * 100 / (idle + busy));
+		printf("\n");
+	}
 }
 
 uint64 
@@ -18,7 +32,13 @@ sys_system_info()
 	struct system_info si;
 	si.memleft = kmemleft();
 	si.diskleft = diskleft();
-	si.n_cpu = 0;	
+	si.n_cpu = 0;
+	for (int i = 0; i < NCPU; i++) {
+		si.idle_cycles[i] = si.busy_cycles[i] = 0;
+		if (cpustat(i, &si.idle_cycles[i], &si.busy_cycles[i]) == 0)
+			si.n_cpu++;
+	}
+	kmem_pcp_stat(&si.pcp_alloc_hit, &si.pcp_alloc_miss, &si.pcp_free_hit, &si.pcp_free_miss);
 	if (copyout(0, p, (char *)&si, sizeof(struct system_info)) == -1) 
 		return -1;
 	return 0;
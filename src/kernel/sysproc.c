@@ -1,8 +1,10 @@
 #include "common/types.h"
+#include "kernel/param.h"
 #include "kernel/riscv.h"
 #include "kernel/defs.h"
 #include "kernel/spinlock.h"
 #include "kernel/proc.h"
+#include "kernel/fcntl.h"
 
 uint64
 sys_exit(void)
@@ -35,6 +37,17 @@ sys_wait(void)
   return wait(p);
 }
 
+uint64
+sys_wait4(void)
+{
+  int pid;
+  uint64 p, ru;
+
+  if(argint(0, &pid) < 0 || argaddr(1, &p) < 0 || argaddr(2, &ru) < 0)
+    return -1;
+  return wait4(pid, p, ru);
+}
+
 uint64
 sys_sbrk(void)
 {
@@ -43,31 +56,88 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  ret = myproc()->addrinfo.heap_end;
-  if(growproc(n) < 0)
+  if(growproc(n, &ret) < 0)
     return -1;
   return ret;
 }
 
+uint64
+sys_madvise(void)
+{
+  uint64 addr, len;
+  int advice;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0 || argint(2, &advice) < 0)
+    return -1;
+  if(advice != MADV_WILLNEED)
+    return -1;
+  return vmapopulate(myproc()->group, addr, len);
+}
+
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futex_wait(addr, val);
+}
+
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futex_wake(addr, n);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  if(argint(0, &tid) < 0 || argaddr(1, &p) < 0)
+    return -1;
+  return join(tid, p);
+}
+
 uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   if(argint(0, &n) < 0)
     return -1;
-  ACQUIRE(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      RELEASE(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  RELEASE(&tickslock);
-  return 0;
+  if(n <= 0)
+    return myproc()->killed ? -1 : 0;
+  return timersleep(r_time() + (uint64)n * TICKCYCLES);
+}
+
+// sleep for ns nanoseconds, to the resolution of r_time().
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns, nspercycle = 1000000000 / TIMEBASE;
+
+  if(argaddr(0, &ns) < 0)
+    return -1;
+  return timersleep(r_time() + (ns + nspercycle - 1) / nspercycle);
 }
 
 uint64
@@ -97,7 +167,7 @@ uint64
 sys_trace(void)
 {
   // 获取系统调用的参数
-  argint(0, &(myproc()->trace_mask));
+  argaddr(0, &(myproc()->trace_mask));
   return 0;
 }
 
@@ -131,7 +201,40 @@ sys_pgaccess(void)
       *pte &= ~PTE_A;	   // 清空PTE_A
     }
   }
+  // 刷新TLB, 再次访问时硬件才会重新设置PTE_A
+  tlbflush(myproc(), addr, num);
   // 写回用户空间
   copyout(0, mask, (char *)&bufmask, num % 8 == 0 ? num / 8 : num / 8 + 1);
   return 0;
-}
\ No newline at end of file
+}
+
+uint64
+sys_nice(void)
+{
+  int inc;
+
+  if(argint(0, &inc) < 0)
+    return -1;
+  return nice(inc);
+}
+
+uint64
+sys_setpriority(void)
+{
+  int pid, level;
+
+  if(argint(0, &pid) < 0 || argint(1, &level) < 0)
+    return -1;
+  return setpriority(pid, level);
+}
+
+uint64
+sys_getprocs(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return procinfo(addr, n);
+}
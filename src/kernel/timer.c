@@ -0,0 +1,131 @@
+// High-resolution timers.
+//
+// Each hart keeps a min-heap of the timers set on it, ordered
+// by deadline in r_time() cycles. The earliest deadline goes
+// to timervec through timerset(), which makes the CLINT
+// interrupt then, or at the next tick if that is sooner.
+// devintr() calls timerintr(), which wakes the sleeper of
+// each timer that has expired, and only that one.
+//
+// A sleeper has one timer at most, so each process has its own
+// in ptimer[]: not on its kernel stack, which only its own page
+// table maps, while timerintr() runs on whatever process the
+// hart is on. A timer stays on the heap of the hart it was set
+// on even if the sleeper moves to another hart.
+
+#include "common/types.h"
+#include "kernel/param.h"
+#include "kernel/spinlock.h"
+#include "kernel/riscv.h"
+#include "kernel/proc.h"
+#include "kernel/defs.h"
+
+struct timer {
+  uint64 when;                // deadline, in r_time() cycles
+  int fired;
+  int idx;                    // position in the heap
+};
+
+struct {
+  struct spinlock lock;
+  struct timer *heap[NPROC];  // a sleeper has one timer at most
+  int n;
+} timers[NCPU];
+
+extern struct proc proc[NPROC];
+static struct timer ptimer[NPROC];
+
+void
+timersinit(void)
+{
+  for(int i = 0; i < NCPU; i++)
+    initlock(&timers[i].lock, "timers");
+}
+
+static void
+heap_set(struct timer **heap, int i, struct timer *t)
+{
+  heap[i] = t;
+  t->idx = i;
+}
+
+// Restore the heap order around position i.
+static void
+heap_fix(struct timer **heap, int n, int i)
+{
+  struct timer *t = heap[i];
+  int c;
+
+  while(i > 0 && heap[(i-1)/2]->when > t->when){
+    heap_set(heap, i, heap[(i-1)/2]);
+    i = (i-1)/2;
+  }
+  while((c = 2*i+1) < n){
+    if(c+1 < n && heap[c+1]->when < heap[c]->when)
+      c++;
+    if(heap[c]->when >= t->when)
+      break;
+    heap_set(heap, i, heap[c]);
+    i = c;
+  }
+  heap_set(heap, i, t);
+}
+
+// Take heap[i] off the heap. Caller holds the lock.
+static void
+heap_remove(struct timer **heap, int *n, int i)
+{
+  (*n)--;
+  if(i < *n){
+    heap_set(heap, i, heap[*n]);
+    heap_fix(heap, *n, i);
+  }
+}
+
+// Sleep until r_time() reaches when.
+// Returns 0, or -1 if killed first.
+int
+timersleep(uint64 when)
+{
+  struct proc *p = myproc();
+  struct timer *t = &ptimer[p - proc];
+  int hart;
+
+  t->when = when;
+  t->fired = 0;
+  push_off();
+  hart = cpuid();
+  ACQUIRE(&timers[hart].lock);
+  pop_off();
+  heap_set(timers[hart].heap, timers[hart].n, t);
+  heap_fix(timers[hart].heap, ++timers[hart].n, t->idx);
+  if(t->idx == 0)
+    timerset(when);
+  while(!t->fired && !p->killed)
+    sleep(t, &timers[hart].lock);
+  if(!t->fired)
+    heap_remove(timers[hart].heap, &timers[hart].n, t->idx);
+  RELEASE(&timers[hart].lock);
+  return t->fired ? 0 : -1;
+}
+
+// Wake the sleepers of this hart's expired timers, and ask
+// for an interrupt at the next deadline.
+// Called from devintr() with interrupts off.
+void
+timerintr(void)
+{
+  int hart = cpuid();
+  struct timer *t;
+
+  if(timers[hart].n == 0)
+    return;
+  ACQUIRE(&timers[hart].lock);
+  while(timers[hart].n > 0 && (t = timers[hart].heap[0])->when <= r_time()){
+    heap_remove(timers[hart].heap, &timers[hart].n, 0);
+    t->fired = 1;
+    wakeup(t);
+  }
+  timerset(timers[hart].n > 0 ? timers[hart].heap[0]->when : ~0ULL);
+  RELEASE(&timers[hart].lock);
+}
@@ -4,15 +4,17 @@
 #include "kernel/spinlock.h"
 #include "kernel/proc.h"
 #include "kernel/defs.h"
+#include "kernel/fcntl.h"
 
 struct spinlock tickslock;
 uint ticks;
 
 extern char trampoline[], uservec[], userret[];
+extern char umemfault[];  // umem.S
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
-void do_page_fault(struct proc *p, uint64 stval);
+int do_page_fault(struct proc *p, uint64 stval);
 extern int devintr();
 
 void
@@ -26,6 +28,8 @@ void
 trapinithart(void)
 {
   w_stvec((uint64)kernelvec);
+  // let user code read the time CSR, for the vdso clock.
+  w_scounteren(r_scounteren() | 2);
 }
 
 //
@@ -45,6 +49,11 @@ usertrap(void)
   w_stvec((uint64)kernelvec);
 
   struct proc *p = myproc();
+  uint64 now = r_time();
+
+  // the time since usertrapret() was spent in user space.
+  p->ru.utime += now - p->rustamp;
+  p->rustamp = now;
   
   // save user program counter.
   p->trapframe->epc = r_sepc();
@@ -63,7 +72,7 @@ usertrap(void)
     intr_on();
 
     syscall();
-  } else if (r_scause() == 13 || r_scause() == 15) { // store or load page fault 
+  } else if (r_scause() == 12 || r_scause() == 13 || r_scause() == 15) { // page fault
     do_page_fault(p, r_stval());
   } else if((which_dev = devintr()) != 0){
     // ok
@@ -77,9 +86,12 @@ usertrap(void)
   if(p->killed)
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
+  // maybe give up the CPU if this is a timer interrupt,
+  // or another hart asks.
   if(which_dev == 2)
-    yield();
+    schedtick();
+  else if(which_dev == 3)
+    preempt();
 
   usertrapret();
 }
@@ -97,12 +109,17 @@ usertrapret(void)
   // we're back in user space, where usertrap() is correct.
   intr_off();
 
+  // and the time since usertrap(), or since this process was
+  // last switched to, in the kernel.
+  uint64 now = r_time();
+  p->ru.stime += now - p->rustamp;
+  p->rustamp = now;
+
   // send syscalls, interrupts, and exceptions to trampoline.S
   w_stvec(TRAMPOLINE + (uservec - trampoline));
 
   // set up trapframe values that uservec will need when
   // the process next re-enters the kernel.
-  p->trapframe->kernel_satp = r_satp(); // kernel page table
   p->trapframe->kernel_sp = p->kstackbase + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
@@ -119,14 +136,11 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
-
   // jump to trampoline.S at the top of memory, which 
-  // switches to the user page table, restores user registers,
-  // and switches to user mode with sret.
+  // restores user registers and switches to user mode
+  // with sret. the page table stays, see kvmcreate().
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64))fn)(p->tfva);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -145,19 +159,31 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if (r_scause() == 13 || r_scause() == 15) { // store or load page fault 
-    do_page_fault(p, r_stval());
+  if (scause == 13 || scause == 15) { // store or load page fault 
+    // a user address umemmove() may not touch makes it
+    // return -1; any other bad fault is the kernel's bug.
+    if (p == 0 || do_page_fault(p, r_stval()) < 0) {
+      if (p == 0 || sepc < (uint64)umemmove || sepc >= (uint64)umemfault) {
+        printf("scause %p\n", scause);
+        printf("sepc=%p stval=%p\n", sepc, r_stval());
+        panic("kerneltrap: page fault");
+      }
+      sepc = (uint64)umemfault;
+    }
   } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
+  // maybe give up the CPU if this is a timer interrupt,
+  // or another hart asks.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+    schedtick();
+  else if(which_dev == 3 && myproc() != 0 && myproc()->state == RUNNING)
+    preempt();
 
-  // the yield() may have caused some traps to occur,
+  // the schedtick() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
   w_sepc(sepc);
   w_sstatus(sstatus);
@@ -168,13 +194,14 @@ clockintr()
 {
   ACQUIRE(&tickslock);
   ticks++;
-  wakeup(&ticks);
+  vdsotick(ticks);
   RELEASE(&tickslock);
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
+// 3 if an IPI asking to reschedule,
 // 1 if other device,
 // 0 if not recognized.
 int
@@ -205,76 +232,112 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or an IPI, forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
+    // the SSIP bit in sip, before looking at why, so that
+    // one raised meanwhile is not lost.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    int what = ipirecv();
+    if(what & IPI_TLBFLUSH)
+      tlbpoll();
+    timerintr();
+    if(timerfired()){
+      if(cpuid() == 0){
+        clockintr();
+      }
+      // the tick looks at the run queue anyway.
+      return 2;
+    }
+    if(what & IPI_RESCHED)
+      return 3;
+    return 1;
   } else {
     return 0;
   }
 }
 
-static void 
-pre_freeproc(struct proc *p)
+// The PROT_ access of the page fault being taken.
+static int
+faultaccess(void)
 {
-  if(p->trapframe)
-    kfree((void*)p->trapframe);
-  p->trapframe = 0;
-  if(p->usyscall)
-    kfree((void*)p->usyscall);
-  p->usyscall = 0;
-  proc_free_pagetable(p);
-  proc_free_kpagetable(p, 0);
+  switch (r_scause()) {
+  case 12: return PROT_EXEC;
+  case 15: return PROT_WRITE;
+  default: return PROT_READ;
+  }
 }
 
-void 
-do_page_fault(struct proc *p, uint64 stval)
+// Whether the fault at va has been dealt with already, by
+// another thread of the group that took it at the same time.
+// Caller holds the group's vmlock.
+static int
+spurious_fault(struct proc *g, uint64 va)
 {
-  // if sp below the stack bottom, set it 
-  if (p->addrinfo.stack_bottom > PGROUNDDOWN(p->trapframe->sp)) {
-    p->addrinfo.stack_bottom = PGROUNDDOWN(p->trapframe->sp);
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  // the kernel's own pages are in the table too, without PTE_U.
+  if((pte = walk(g->pagetable, va, 0)) == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+    return 0;
+  switch (faultaccess()) {
+  case PROT_EXEC: return (*pte & PTE_X) != 0;
+  case PROT_WRITE: return (*pte & PTE_W) != 0;
+  default: return (*pte & PTE_R) != 0;
   }
-  if (uaddrvalid(p, stval)) {
-    if (cowpage(p, stval)) { // this is copy on write
-      if (uvmrealloc(p, PGROUNDDOWN(stval)) != 0) {
-        printf("out of memory for cow(stval=0x%lx pid=%d sepc=0x%lx)\n", stval, p->pid, r_sepc());
-        goto bad;
-      }
-    } else if (stval >= PROC_HEAP_BASE(p) && stval < PROC_HEAP_END(p)) { // lazy
-      if (uvmalloc(p, PGROUNDDOWN(stval), PGROUNDDOWN(stval) + PGSIZE) == -1) {
-        printf("out of memory for lazy(stval=0x%lx pid=%d sepc=0x%lx)\n", stval, p->pid, r_sepc());
-        goto bad;
-      }
-    } else if (stval >= PROC_STACK_BASE(p) && stval < PROC_STACK_END(p)) { // stack grows down
-      // lazy deal stack grows, only alloc memory that triggers page fault.
-      // tag stack_bottom to minimum stack address, such that all allocated memory can be
-      // freed in freeproc stage.
-      if (uvmalloc(p, PGROUNDDOWN(stval), PGROUNDDOWN(stval) + PGSIZE) == -1) {
-        printf("out of memory for stack(stval=0x%lx pid=%d sepc=0x%lx)\n", stval, p->pid, r_sepc());
-        goto bad;
-      }
-    } else {
-      printf("segmentation fault on valid 0x%lx(pid=%d sepc=0x%lx)\n", stval, p->pid, r_sepc());
-      goto bad;
-    }
-  } else {
-    printf("segmentation fault on invalid 0x%lx(pid=%d sepc=0x%lx)\n", stval, p->pid, r_sepc());
+}
+
+// Deal with a page fault at stval, in user space or in the
+// kernel on a user address. Returns 0 if the access can be
+// retried. Otherwise returns -1, and for a fault in user
+// space kills the process; the kernel's caller decides.
+int
+do_page_fault(struct proc *t, uint64 stval)
+{
+  // the memory is the group's; t is the thread that faulted.
+  struct proc *p = t->group;
+  uint64 sp = PGROUNDDOWN(t->trapframe->sp);
+  int user = (r_sstatus() & SSTATUS_SPP) == 0;
+  struct vma *v;
+
+  ACQUIRE(&p->vmlock);
+  if (spurious_fault(p, stval)) {
+    RELEASE(&p->vmlock);
+    return 0;
+  }
+  // if sp is below the stack, the stack grows down to it.
+  // not for a thread whose stack is in the heap or a mapping.
+  if (p->addrinfo.stack_bottom > sp && sp >= MMAP_END && vmagrowdown(p, sp) == 0) {
+    p->addrinfo.stack_bottom = sp;
+  }
+  if ((v = vmafind(p, stval)) == 0) {
+    if (user)
+      printf("segmentation fault on invalid 0x%lx(pid=%d sepc=0x%lx)\n", stval, t->pid, r_sepc());
     goto bad;
   }
-  return;
-bad:
-  if (r_sstatus() & SSTATUS_SPP)
-    backtrace(1, 0);
+  if (cowpage(p, stval))
+    t->ru.cowflt++;
   else
-    backtrace(1, 1);
-  pre_freeproc(p); // pre free proc
-  p->killed = 1;
-}
\ No newline at end of file
+    t->ru.minflt++;
+  if (v->ops->fault(p, v, stval, faultaccess()) < 0) {
+    if (user)
+      printf("bad access to %s(stval=0x%lx pid=%d sepc=0x%lx)\n", v->ops->name, stval, t->pid, r_sepc());
+    goto bad;
+  }
+  RELEASE(&p->vmlock);
+  return 0;
+bad:
+  RELEASE(&p->vmlock);
+  if (!user)
+    return -1;
+  backtrace(1, 1);
+  t->killed = 1;
+  // the other threads still run in the memory; the
+  // leader's exit() takes them down.
+  if (t != p || p->nthreads > 0)
+    kill(p->pid);
+  return -1;
+}
@@ -0,0 +1,49 @@
+// The vDSO page: one read-only page, mapped at VDSO in every
+// process, through which user code reads the clock and the
+// load average without a system call (see ulib.c).
+//
+// Hart 0 rewrites it on every tick. It is a seqcount: the
+// kernel makes seq odd, updates the rest, and makes seq even
+// again; a reader reads seq, then the data, then seq again,
+// and retries if seq was odd or has changed.
+
+#include "common/types.h"
+#include "common/stdlib.h"
+#include "kernel/param.h"
+#include "kernel/memlayout.h"
+#include "kernel/riscv.h"
+#include "kernel/defs.h"
+
+// the load average decays over a minute,
+// sampled every LOADTICKS ticks (5 seconds).
+#define LOADTICKS (5 * TIMEBASE / TICKCYCLES)
+#define LOADEXP   1884   // LOADSCALE / e^(5/60)
+
+struct vdso *vdso;
+
+void
+vdsoinit(void)
+{
+  if((vdso = (struct vdso*)kalloc()) == 0)
+    panic("vdsoinit");
+  memset(vdso, 0, PGSIZE);
+  vdso->timebase = TIMEBASE;
+}
+
+// Called by clockintr() on every tick, on hart 0.
+void
+vdsotick(uint ticks)
+{
+  uint64 n;
+
+  vdso->seq++;
+  __sync_synchronize();
+  vdso->ticks = ticks;
+  vdso->time = r_time();
+  if(ticks % LOADTICKS == 0){
+    n = nrunnable() * LOADSCALE;
+    vdso->loadavg = (vdso->loadavg * LOADEXP + n * (LOADSCALE - LOADEXP)) >> LOADSHIFT;
+  }
+  __sync_synchronize();
+  vdso->seq++;
+}
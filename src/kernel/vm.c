@@ -4,6 +4,7 @@
 #include "kernel/defs.h"
 #include "kernel/proc.h"
 #include "kernel/riscv.h"
+#include "kernel/fcntl.h"
 
 /*
  * the kernel's page table.
@@ -14,6 +15,18 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// A process has one ASID, for its page table; 0 is for
+// kernel_pagetable. They are never given back. When they run
+// out, a new generation starts over from 1, and a hart flushes
+// its whole TLB the first time it runs a process from another
+// generation than the one it last flushed for.
+struct {
+  struct spinlock lock;
+  uint nasid;         // ASIDs the harts implement, 0 if too few
+  uint next;
+  uint64 generation;
+} asids;
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -29,6 +42,9 @@ kvmmake(void)
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+  // CLINT, for sending IPIs
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
@@ -50,15 +66,245 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  initlock(&asids.lock, "asids");
+  asids.next = 1;
+  asids.generation = 1;
+}
+
+// Give pagetable private copies of the kernel_pagetable tables
+// on the way to va, down to the table at level, so that mappings
+// made there do not show up in every process.
+static int
+kvmunshare(pagetable_t pagetable, uint64 va, int level)
+{
+  pagetable_t kpgtbl = kernel_pagetable;
+
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
+    pte_t kpte = kpgtbl[PX(l, va)];
+    if((kpte & PTE_V) == 0 || PTE_LEAF(kpte))
+      return 0;   // nothing shared further down
+    if(*pte == kpte) {
+      pagetable_t copy = (pagetable_t)kalloc();
+      if(copy == 0)
+        return -1;
+      memmove(copy, (void*)PTE2PA(kpte), PGSIZE);
+      *pte = PA2PTE(copy) | PTE_V;
+    }
+    pagetable = (pagetable_t)PTE2PA(*pte);
+    kpgtbl = (pagetable_t)PTE2PA(kpte);
+  }
+  return 0;
+}
+
+// Create a process's page table. The kernel and user space
+// both run on it: user pages are mapped once, with PTE_U, and
+// the kernel reaches them with sstatus.SUM set, while user
+// code cannot touch the kernel's pages, which lack PTE_U.
+// Its root starts as a copy of kernel_pagetable's, so the
+// kernel map below it is shared, not rebuilt. Only the GiB of
+// the devices (also user code) and the GiB of the trampoline
+// (also trapframe, kernel stack and user stack) get tables of
+// their own. Returns 0 if out of memory.
+pagetable_t
+kvmcreate(void)
+{
+  pagetable_t pagetable;
+
+  if((pagetable = (pagetable_t)kalloc()) == 0)
+    return 0;
+  memmove(pagetable, kernel_pagetable, PGSIZE);
+  if(kvmunshare(pagetable, 0, 1) < 0 || kvmunshare(pagetable, TRAMPOLINE, 0) < 0){
+    kvmfree(pagetable);
+    return 0;
+  }
+  return pagetable;
+}
+
+static void
+kvmfree_level(pagetable_t pagetable, pagetable_t kpgtbl)
+{
+  for(int i = 0; i < 512; i++){
+    pte_t pte = pagetable[i];
+    pte_t kpte = kpgtbl ? kpgtbl[i] : 0;
+    if((pte & PTE_V) == 0 || PTE_LEAF(pte) || pte == kpte)
+      continue;
+    if((kpte & PTE_V) == 0 || PTE_LEAF(kpte))
+      kpte = 0;
+    kvmfree_level((pagetable_t)PTE2PA(pte), (pagetable_t)PTE2PA(kpte));
+  }
+  kfree((void*)pagetable);
+}
+
+// Free a table from kvmcreate(): its own page-table pages,
+// but none of those shared with kernel_pagetable. Leaves are
+// left alone, so user memory must already be unmapped.
+void
+kvmfree(pagetable_t pagetable)
+{
+  kvmfree_level(pagetable, kernel_pagetable);
 }
 
 // Switch h/w page table register to the kernel's page table,
-// and enable paging.
+// and enable paging. Let the kernel at user pages, see
+// kvmcreate(); usertrapret() and the traps keep the bit.
 void
 kvminithart()
 {
-  w_satp(MAKE_SATP(kernel_pagetable));
+  uint64 asid;
+
+  w_sstatus(r_sstatus() | SSTATUS_SUM);
+
+  // the ASID bits that stick are the ones implemented.
+  w_satp(MAKE_SATP(kernel_pagetable, SATP_ASID_MAX));
+  asid = GET_ASID(r_satp());
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
   sfence_vma();
+  if(cpuid() == 0 && asid >= 1)
+    asids.nasid = asid + 1;
+}
+
+// Give p an ASID of the current generation.
+static void
+asidalloc(struct proc *p)
+{
+  ACQUIRE(&asids.lock);
+  if(p->asid_gen != asids.generation){
+    if(asids.next >= asids.nasid){
+      asids.generation++;
+      asids.next = 1;
+    }
+    p->asid = asids.next++;
+    p->asid_gen = asids.generation;
+  }
+  RELEASE(&asids.lock);
+}
+
+// Return the satp for running p's page table on this hart,
+// or kernel_pagetable's if p is 0, after the ASID bookkeeping
+// and flushes that needs. The ASID in it is 0 only if the
+// harts have none, and then the TLB must be flushed after
+// loading it. The ASID is that of p's thread group, which
+// may be running on other harts too.
+// Caller holds p->lock, has set mycpu()->proc to p, and has
+// interrupts off.
+uint64
+kvmsatp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint mask = 1 << cpuid();
+  struct proc *g;
+
+  if(asids.nasid == 0)
+    return MAKE_SATP(p ? p->pagetable : kernel_pagetable, 0);
+  if(p == 0)
+    return MAKE_SATP(kernel_pagetable, 0);
+  g = p->group;
+  if(g->asid_gen != __atomic_load_n(&asids.generation, __ATOMIC_ACQUIRE))
+    asidalloc(g);
+  // c->proc is set before tlbstale is read here, and tlbflush()
+  // sets tlbstale before it reads c->proc, so either we flush
+  // here or it interrupts us.
+  __sync_synchronize();
+  if(c->asid_gen != g->asid_gen){
+    // this hart may hold entries of g's ASID left from
+    // its owners in another generation.
+    sfence_vma();
+    c->asid_gen = g->asid_gen;
+    __atomic_fetch_and(&g->tlbstale, ~mask, __ATOMIC_RELAXED);
+  } else if(__atomic_load_n(&g->tlbstale, __ATOMIC_ACQUIRE) & mask){
+    sfence_vma_asid(g->asid);
+    __atomic_fetch_and(&g->tlbstale, ~mask, __ATOMIC_RELAXED);
+  }
+  return MAKE_SATP(g->pagetable, g->asid);
+}
+
+// Switch this hart to p's page table, or to
+// kernel_pagetable if p is 0. Must run on a stack mapped
+// in both tables, like the scheduler's.
+void
+kvmswitch(struct proc *p)
+{
+  w_satp(kvmsatp(p));
+  if(asids.nasid == 0)
+    sfence_vma();
+}
+
+// Interrupt the other harts that run a thread of group g
+// now, and wait until each has flushed its TLB.
+// Called with interrupts off.
+static void
+tlbshootdown(struct proc *g)
+{
+  uint want[NCPU];
+  uint sent = 0;
+  struct proc *q;
+  int i;
+
+  // the page table changes and tlbstale before c->proc,
+  // see kvmsatp().
+  __sync_synchronize();
+  for(i = 0; i < NCPU; i++){
+    q = __atomic_load_n(&cpus[i].proc, __ATOMIC_RELAXED);
+    if(i == cpuid() || q == 0 || q->group != g)
+      continue;
+    want[i] = __atomic_add_fetch(&cpus[i].flushreq, 1, __ATOMIC_ACQ_REL);
+    sent |= 1 << i;
+    ipi(i, IPI_TLBFLUSH);
+  }
+  for(i = 0; i < NCPU; i++){
+    if((sent & (1 << i)) == 0)
+      continue;
+    // the target may be spinning for a lock we hold, or be
+    // waiting on us in here; both keep doing tlbpoll().
+    while((int)(__atomic_load_n(&cpus[i].nflush, __ATOMIC_ACQUIRE) - want[i]) < 0)
+      tlbpoll();
+  }
+}
+
+// Do the flushes other harts have asked of this one in
+// tlbshootdown(). Called with interrupts off: from devintr(),
+// and from the loops where a hart spins, so that it cannot
+// hold up a hart that waits for it.
+void
+tlbpoll(void)
+{
+  struct cpu *c = mycpu();
+  uint want = __atomic_load_n(&c->flushreq, __ATOMIC_ACQUIRE);
+
+  if(want == c->nflush)
+    return;
+  // flushreq is read first, so the flush covers every
+  // change made before it was asked for.
+  sfence_vma();
+  __atomic_store_n(&c->nflush, want, __ATOMIC_RELEASE);
+}
+
+// p's page tables changed for npages at va, or for all of
+// p if npages is 0. Flush the entries on this hart and on
+// the harts running other threads of p's group now; the
+// rest flush all of the group's when they next run it.
+void
+tlbflush(struct proc *p, uint64 va, uint64 npages)
+{
+  struct proc *g = p->group;
+
+  push_off();
+  if(asids.nasid == 0){
+    sfence_vma();
+  } else if(g->asid == 0){
+    pop_off();
+    return;   // no ASIDs yet, so nothing cached
+  } else if(npages == 0 || npages > 32){
+    sfence_vma_asid(g->asid);
+  } else {
+    for(uint64 a = va; a < va + npages*PGSIZE; a += PGSIZE)
+      sfence_vma_page(a, g->asid);
+  }
+  if(asids.nasid != 0)
+    __atomic_store_n(&g->tlbstale, ~(1 << cpuid()), __ATOMIC_RELEASE);
+  tlbshootdown(g);
+  pop_off();
 }
 
 // Return the address of the PTE in page table pagetable
@@ -75,13 +321,25 @@ kvminithart()
 //    0..11 -- 12 bits of byte offset within the page.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, alloc, 0);
+}
+
+// Like walk(), but return the PTE at level instead of level 0:
+// 1 for a 2 MiB megapage, 2 for a 1 GiB gigapage. A superpage
+// leaf met on the way down is returned as is, so a caller that
+// maps must check PTE_V before writing the PTE.
+pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int level)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
       if(!alloc || (pagetable = (pte_t*)kalloc()) == 0)
@@ -90,7 +348,25 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(level, va)];
+}
+
+// Return the leaf PTE that maps va, whatever its level,
+// and set *size to the bytes it maps. 0 if not mapped.
+static pte_t *
+walkleaf(pagetable_t pagetable, uint64 va, uint64 *size)
+{
+  for(int level = 2; level >= 0; level--) {
+    pte_t *pte = &pagetable[PX(level, va)];
+    if((*pte & PTE_V) == 0)
+      return 0;
+    if(PTE_LEAF(*pte) || level == 0) {
+      *size = LEVELSIZE(level);
+      return pte;
+    }
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  }
+  return 0;
 }
 
 // Look up a virtual address, return the physical page address 
@@ -119,7 +395,7 @@ walkaddr(pagetable_t pagetable, uint64 va)
 uint64
 kvmpa(uint64 va)
 {
-  return vmpa(myproc()->kpagetable, va);
+  return vmpa(myproc()->pagetable, va);
 }
 
 uint64
@@ -128,17 +404,13 @@ vmpa(pagetable_t pagetable, uint64 va)
   if(va >= MAXVA)
     return 0;
 
-  uint64 off = va % PGSIZE;
+  uint64 size;
   pte_t *pte;
-  uint64 pa;
 
-  pte = walk(pagetable, va, 0);
+  pte = walkleaf(pagetable, va, &size);
   if(pte == 0)
     panic("vmpa");
-  if((*pte & PTE_V) == 0)
-    panic("vmpa");
-  pa = PTE2PA(*pte);
-  return pa + off;
+  return PTE2PA(*pte) + va % size;
 }
 
 // add a mapping to the kernel page table.
@@ -147,39 +419,59 @@ vmpa(pagetable_t pagetable, uint64 va)
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
+  if(mapsuperpages(kpgtbl, va, sz, pa, perm) != 0)
     panic("kvmmap");
 }
 
-// Create PTEs for virtual addresses starting at va that refer to
-// physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
-// allocate a needed page-table page.
-int
-mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
+// Map [va, va+size) to pa with leaves of at most maxlevel,
+// picking the largest leaf that va, pa and the rest of the
+// range allow.
+static int
+mapleaves(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm, int maxlevel)
 {
-  uint64 a, last;
+  uint64 a, end;
   pte_t *pte;
+  int level;
 
   if(size == 0)
     panic("mappages: size");
-  
+
   a = PGROUNDDOWN(va);
-  last = PGROUNDDOWN(va + size - 1);
-  for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+  end = PGROUNDUP(va + size);
+  while(a < end){
+    for(level = maxlevel; level > 0; level--)
+      if(((a | pa) & (LEVELSIZE(level) - 1)) == 0 && end - a >= LEVELSIZE(level))
+        break;
+    if((pte = walklevel(pagetable, a, 1, level)) == 0)
       return -1;
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
-      break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += LEVELSIZE(level);
+    pa += LEVELSIZE(level);
   }
   return 0;
 }
 
+// Create PTEs for virtual addresses starting at va that refer to
+// physical addresses starting at pa. va and size might not
+// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// allocate a needed page-table page.
+int
+mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
+{
+  return mapleaves(pagetable, va, size, pa, perm, 0);
+}
+
+// Like mappages(), but use 2 MiB and 1 GiB leaves where the
+// addresses line up. Such a range can only be unmapped as a
+// whole, so this is for the kernel direct map.
+int
+mapsuperpages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
+{
+  return mapleaves(pagetable, va, size, pa, perm, 2);
+}
+
 // -1 for error
 // -2 for remap
 // 0 for success
@@ -225,19 +517,6 @@ upageunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
   }
 }
 
-// create an empty user page table.
-// returns 0 if out of memory.
-pagetable_t
-upagecreate()
-{
-  pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
-  if(pagetable == 0)
-    return 0;
-  memset(pagetable, 0, PGSIZE);
-  return pagetable;
-}
-
 // Allocate PTEs and physical memory to grow process from old_addr to new_addr
 // need not be page aligned. 
 // Returns allocated page number or -1 on error.
@@ -265,17 +544,13 @@ uvmalloc(struct proc *p, uint64 old_addr, uint64 new_addr)
       printf("[warning] uvmalloc: remap");
       kfree(mem);
     }
-    rc = map_onepage(p->kpagetable, a, (uint64)mem, PTE_W|PTE_X|PTE_R);
-    if (rc == -1) {
-      upageunmap(p->pagetable, a, 1, 1);
-      goto err;
-    } 
     cnt++;
   }
+  tlbflush(p, old_addr, cnt);
   return cnt;
 err:
   upageunmap(p->pagetable, old_addr, cnt, 1);
-  upageunmap(p->kpagetable, old_addr, cnt, 0);
+  tlbflush(p, old_addr, cnt);
   return -1;
 }
 
@@ -284,7 +559,7 @@ err:
 int
 uvmrealloc(struct proc *p, uint64 addr)
 {
-  pte_t *kpte, *pte;
+  pte_t *pte;
   uint64 pa;
   if((pte = walk(p->pagetable, addr, 0)) == 0)
     return -1;
@@ -292,13 +567,6 @@ uvmrealloc(struct proc *p, uint64 addr)
     printf("[warning] uvmrealloc\n");
     return -1;
   } 
-  if((kpte = walk(p->kpagetable, addr, 0)) == 0)
-    return -1;
-  if(!(*kpte & PTE_V) || !(*kpte & PTE_COW) || (*kpte & PTE_W)) {
-    printf("[warning] uvmrealloc\n");
-    return -1;
-  }
-  assert(PTE2PA(*kpte) == PTE2PA(*pte));
   pa = PTE2PA(*pte);
 
   if (get_page_ref((uint64)pa) > 1) {
@@ -307,18 +575,16 @@ uvmrealloc(struct proc *p, uint64 addr)
       return -1;
     memmove(mem, (void *)pa, PGSIZE);
     *pte = PA2PTE(mem) | PTE_FLAGS(*pte);
-    *kpte = PA2PTE(mem) | PTE_FLAGS(*kpte);
-    acquire_page_ref();
-    inc_page_ref((uint64)pa, -1);
-    release_page_ref();
+    // drop our share; frees the page if the other
+    // sharers have gone away in the meantime.
+    kfree((void *)pa);
   } else if (get_page_ref((uint64)pa) < 1) {
     printf("[warning] page_ref < 1\n");
   }
 
   *pte &= ~PTE_COW;     
   *pte |= PTE_W;
-  *kpte &= ~PTE_COW;     
-  *kpte |= PTE_W;
+  tlbflush(p, PGROUNDDOWN(addr), 1);
   return 0;
 }
 
@@ -333,6 +599,40 @@ cowpage(struct proc *p, uint64 addr)
   return 0;
 }
 
+static int
+ptempty(pagetable_t pagetable)
+{
+  for(int i = 0; i < 512; i++)
+    if(pagetable[i] & PTE_V)
+      return 0;
+  return 1;
+}
+
+// Free the page-table pages under [a, b) that map nothing
+// any more, but none shared with kernel_pagetable.
+static void
+uvmfreeptes(pagetable_t pagetable, uint64 a, uint64 b)
+{
+  pte_t *top, *pte;
+  pagetable_t mid;
+
+  for(uint64 va = a & ~(LEVELSIZE(1) - 1); va < b; va += LEVELSIZE(1)){
+    top = &pagetable[PX(2, va)];
+    if((*top & PTE_V) == 0 || PTE_LEAF(*top) || *top == kernel_pagetable[PX(2, va)])
+      continue;
+    mid = (pagetable_t)PTE2PA(*top);
+    pte = &mid[PX(1, va)];
+    if((*pte & PTE_V) && !PTE_LEAF(*pte) && ptempty((pagetable_t)PTE2PA(*pte))){
+      kfree((void*)PTE2PA(*pte));
+      *pte = 0;
+    }
+    if(ptempty(mid)){
+      kfree((void*)mid);
+      *top = 0;
+    }
+  }
+}
+
 // Deallocate user pages to bring the process size from old_addr to
 // new_addr. oldsz and newsz need not be page-aligned.
 // Returns deallocated page number or -1 on error. 
@@ -344,9 +644,9 @@ uvmdealloc(struct proc *p, uint64 old_addr, uint64 new_addr)
 
   int npages = (PGROUNDUP(old_addr) - PGROUNDUP(new_addr)) / PGSIZE;
   upageunmap(p->pagetable, PGROUNDUP(new_addr), npages, 1);
-  upageunmap(p->kpagetable, PGROUNDUP(new_addr), npages, 0);
-  free_pagetable(p->pagetable, PGTBLFREE_JUST_NO_LEAF);
-  free_pagetable(p->kpagetable, PGTBLFREE_JUST_NO_LEAF);
+  uvmfreeptes(p->pagetable, PGROUNDUP(new_addr), PGROUNDUP(old_addr));
+  // page-table pages may be gone too, so not just these pages.
+  tlbflush(p, 0, 0);
   return npages;
 }
 
@@ -395,93 +695,60 @@ free_pagetable(pagetable_t pagetable, int flags)
   return free_page_cnt;
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
-// returns 0 on success, -1 on failure.
-// frees any allocated pages on failure.
+// Give the child the father's regions, and their memory:
+// the pages of shared mappings are shared, and the rest
+// copy-on-write. Caller holds father->vmlock.
+// returns 0 on success, -1 on failure, with the child left
+// without regions or pages.
 int
 uvmcopy(struct proc *father, struct proc *child)
 {
-  pte_t *father_pte, *father_kpte;
+  struct vma *v;
+  pte_t *father_pte;
   uint64 pa, i;
-  uint flags, kflags;
-  int idx;
-
-  uint64 start_addrs[3] = {PROC_CODE_BASE(father), PROC_STACK_BASE(father), PROC_HEAP_BASE(father)};
-  uint64 end_addrs[3] = {PROC_CODE_END(father), PROC_STACK_END(father), PROC_HEAP_END(father)};
+  uint flags;
 
-  for (idx = 0; idx < 3; idx++) {
-    for(i = start_addrs[idx]; i < end_addrs[idx]; i += PGSIZE){
+  for (v = father->vma; v < &father->vma[father->nvma]; v++) {
+    for(i = v->start; i < v->end; i += PGSIZE){
       if((father_pte = walk(father->pagetable, i, 0)) == 0)
         continue;
       if((*father_pte & PTE_V) == 0)
         continue;
-
-      if((father_kpte = walk(father->kpagetable, i, 0)) == 0)
-        continue;
-      if((*father_kpte & PTE_V) == 0)
-        continue;
-
-      assert(PTE2PA(*father_pte) == PTE2PA(*father_kpte));
       pa = PTE2PA(*father_pte);
 
       flags = PTE_FLAGS(*father_pte);
-      if (flags & PTE_W) {
+      if (!(v->flags & MAP_SHARED) && (flags & PTE_W)) {
         flags &= ~PTE_W;
         flags |= PTE_COW;
       }
-      kflags = PTE_FLAGS(*father_kpte);
-      if (kflags & PTE_W) {
-        kflags &= ~PTE_W;
-        kflags |= PTE_COW;
-      }
 
       if(mappages(child->pagetable, i, PGSIZE, (uint64)pa, flags) != 0){
         goto err;
       }
-      if(mappages(child->kpagetable, i, PGSIZE, (uint64)pa, kflags) != 0){
-        upageunmap(child->pagetable, i, 1, 0);
-        goto err;
-      }
       *father_pte = PTE_WITH_FLAGS(*father_pte, flags);
-      *father_kpte = PTE_WITH_FLAGS(*father_kpte, kflags);
 
-      acquire_page_ref();
       inc_page_ref((uint64)pa, 1);
-      release_page_ref();
     }
+    child->vma[child->nvma++] = *v;
+    if(v->f)
+      filedup(v->f);
   }
+  // father's pages turned read-only.
+  tlbflush(father, 0, 0);
   return 0;
 
  err:
-  int j, idx_start = idx;
-  for (; idx >= 0; idx--) {
-    for(j = start_addrs[idx]; j < (idx == idx_start ? i : end_addrs[idx]); j += PGSIZE){
-      if((father_pte = walk(father->pagetable, j, 0)) == 0)
-        continue;
-      if((*father_pte & PTE_V) == 0)
-        continue;
-      if((father_kpte = walk(father->kpagetable, j, 0)) == 0)
-        continue;
-      if((*father_kpte & PTE_V) == 0)
-        continue;
-      assert(PTE2PA(*father_pte) == PTE2PA(*father_kpte));
-
-      if ((*father_pte) & PTE_COW) {
-        *father_pte |= PTE_W;
-        *father_pte &= ~PTE_COW;
-      }
-      if ((*father_kpte) & PTE_COW) {
-        *father_kpte |= PTE_W;
-        *father_kpte &= ~PTE_COW;
-      }
-
-      upageunmap(child->pagetable, j, 1, 1);
-      upageunmap(child->kpagetable, j, 1, 0);
-    }
-  }
+  // the father's pages stay copy-on-write; a write to one
+  // that is no longer shared just makes it writable again.
+  // it keeps the file references, so fileclose() only
+  // counts down.
+  for (v = father->vma; v < &father->vma[father->nvma]; v++)
+    upageunmap(child->pagetable, v->start, (v->end - v->start) / PGSIZE, 1);
+  for (v = child->vma; v < &child->vma[child->nvma]; v++)
+    if(v->f)
+      fileclose(v->f);
+  child->nvma = 0;
+  tlbflush(father, 0, 0);
   return -1;
 }
 
@@ -498,17 +765,28 @@ upageclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Whether all of [va, va+len) lies in p's regions, with no
+// gap between them, and each allows access: PROT_READ or
+// PROT_WRITE.
 int 
-uaddrvalid(struct proc *p, uint64 va) 
+uaddrvalid(struct proc *p, uint64 va, uint64 len, int access) 
 {
-  uint64 start_addrs[3] = {PROC_CODE_BASE(p), PROC_STACK_BASE(p), PROC_HEAP_BASE(p)};
-  uint64 end_addrs[3] = {PROC_CODE_END(p), PROC_STACK_END(p), PROC_HEAP_END(p)};
-  for (int i = 0; i < 3; i++) {
-    if (va >= start_addrs[i] && va < end_addrs[i]) {
-      return 1;
+  struct proc *g = p->group;
+  int want = access == PROT_WRITE ? PROT_WRITE : PROT_READ | PROT_WRITE;
+  struct vma *v;
+  int ok = 1;
+
+  if (va + len < va)
+    return 0;
+  ACQUIRE(&g->vmlock);
+  for (uint64 a = va; a < va + len; a = v->end) {
+    if ((v = vmafind(g, a)) == 0 || (v->prot & want) == 0) {
+      ok = 0;
+      break;
     }
   }
-  return 0;
+  RELEASE(&g->vmlock);
+  return ok;
 }
 
 // Copy from kernel to user.
@@ -536,11 +814,9 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
     }
     return 0;
   } else {
-    struct proc *p = myproc();
-    if (!uaddrvalid(p, dstva) || !uaddrvalid(p, dstva + len - 1))
+    if (!uaddrvalid(myproc(), dstva, len, PROT_WRITE))
       return -1;
-    memmove((void *)dstva, src, len);
-    return 0;
+    return umemmove((void *)dstva, src, len);
   }
 }
 
@@ -550,11 +826,9 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 int
 copyin(char *dst, uint64 srcva, uint64 len)
 {
-  struct proc *p = myproc();
-  if (!uaddrvalid(p, srcva) || !uaddrvalid(p, srcva + len - 1))
+  if (!uaddrvalid(myproc(), srcva, len, PROT_READ))
     return -1;
-  memmove(dst, (void *)srcva, len);
-  return 0;
+  return umemmove(dst, (void *)srcva, len);
 }
 
 // Copy a null-terminated string from user to kernel.
@@ -564,24 +838,24 @@ copyin(char *dst, uint64 srcva, uint64 len)
 int
 copyinstr(char *dst, uint64 srcva, uint64 max)
 {
-  struct proc *p = myproc();
-  char *src = (char *)srcva;
-  int gotnull = 0;
-  while(max-- > 0) {
-    char t;
-    if (!uaddrvalid(p, (uint64)src)) {
+  uint64 n;
+
+  // a page at a time: the bytes after the null in it are
+  // there to be read too.
+  while(max > 0) {
+    n = PGSIZE - srcva % PGSIZE;
+    if (n > max)
+      n = max;
+    if (copyin(dst, srcva, n) < 0)
       return -1;
-    }
-    t = *dst++ = *src++;
-    if (t == 0) {
-      gotnull = 1;
-      break;
-    }
+    for (uint64 i = 0; i < n; i++)
+      if (dst[i] == 0)
+        return 0;
+    dst += n;
+    srcva += n;
+    max -= n;
   }
-  if (gotnull)
-    return 0;
-  else
-    return -1;
+  return -1;
 }
 
 void
@@ -605,19 +879,15 @@ xprint(pagetable_t pagetable, uint64 srcva, uint64 bytes)
 static uint64 vmprint_buf[2];
 static int vmignore(int level, int i) 
 {
-  // 0 128 0 to
-  // 2 64  0 ignore
   /*
-  means...
-  0 96 0 to 0 512 512
-  all 1 . .
-  2 0 0 to 2 64 0
+  ignore...
+  0 96 0 to 0 512 512   devices
+  all 2 . .             kernel text, data and RAM
   */
   if (level == 1) {
-    if (i == 1) return 1;
+    if (i == PX(2, KERNBASE)) return 1;
   } else if (level == 2) {
     if (vmprint_buf[0] == 0 && i >= 96) return 1;
-    if (vmprint_buf[0] == 2 && i < 64) return 1;
   }
   return 0;
 }
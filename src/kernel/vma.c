@@ -0,0 +1,301 @@
+// The regions of a process's address space.
+//
+// A group leader keeps its regions in p->vma[0..nvma), under
+// its vmlock, sorted by start and apart from each other, so
+// that finding the one an address is in is a binary search.
+// The program's code, its heap and its stack are regions like
+// those of mmap(), and each kind has its own page fault
+// handler in its ops: code only takes copy-on-write faults,
+// the heap and the stack get a page of zeroes when first
+// touched, and mmap() regions are in mmap.c.
+//
+// A heap or stack fault next to a page that is already there
+// looks like memory being touched in order, so it maps the
+// FAULTAROUND pages ahead of it in one go; a sparse one maps
+// just its own page. madvise(MADV_WILLNEED) fills in a whole
+// range without any faults.
+//
+// A read of the heap where nothing has been written yet maps
+// zeropage, one page of zeroes that all processes share,
+// copy-on-write, so that only a write allocates a page.
+//
+// A fixed array rather than a tree: a process has few
+// regions, and a proc holds them like it holds its files.
+
+#include "common/stdlib.h"
+#include "common/types.h"
+#include "kernel/param.h"
+#include "kernel/memlayout.h"
+#include "kernel/spinlock.h"
+#include "kernel/riscv.h"
+#include "kernel/proc.h"
+#include "kernel/defs.h"
+#include "kernel/fcntl.h"
+
+// The first of g's regions that ends above va, or 0. The
+// regions are apart, so sorted by end as well as by start.
+static struct vma*
+vmaabove(struct proc *g, uint64 va)
+{
+  int lo = 0, hi = g->nvma, mid;
+
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    if(g->vma[mid].end <= va)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < g->nvma ? &g->vma[lo] : 0;
+}
+
+// The region of g that va is in, or 0.
+// Caller holds g->vmlock.
+struct vma*
+vmafind(struct proc *g, uint64 va)
+{
+  struct vma *v = vmaabove(g, va);
+
+  if(v && v->start <= va)
+    return v;
+  return 0;
+}
+
+// Whether a region of g overlaps [va, va+len). An empty one
+// counts if it starts inside: the heap grows from its start.
+int
+vmaoverlap(struct proc *g, uint64 va, uint64 len)
+{
+  struct vma *v = vmaabove(g, va);
+
+  return v && v->start < va + len;
+}
+
+// Where len bytes fit between MMAP_BASE and MMAP_END: at addr
+// if that is free, else in the lowest gap. 0 if there is no
+// room.
+uint64
+vmaplace(struct proc *g, uint64 addr, uint64 len)
+{
+  struct vma *v;
+
+  if(addr >= MMAP_BASE && addr <= MMAP_END && len <= MMAP_END - addr && !vmaoverlap(g, addr, len))
+    return addr;
+  addr = MMAP_BASE;
+  for(v = g->vma; v < &g->vma[g->nvma]; v++){
+    if(v->end <= addr)
+      continue;
+    if(v->start >= addr + len)
+      break;
+    addr = v->end;
+  }
+  if(addr > MMAP_END || len > MMAP_END - addr)
+    return 0;
+  return addr;
+}
+
+// Add the region [start, end) to g, in its place among the
+// others, with no file. Returns it, or 0 if g has no room or
+// it overlaps another. Caller holds g->vmlock; the pointers
+// to g's regions move when one is added or removed.
+struct vma*
+vmainsert(struct proc *g, uint64 start, uint64 end, int prot, int flags, struct vmaops *ops)
+{
+  struct vma *v;
+  int i;
+
+  if(g->nvma == NVMA || end < start)
+    return 0;
+  if(start < end && vmaoverlap(g, start, end - start))
+    return 0;
+  for(i = 0; i < g->nvma && g->vma[i].start < start; i++)
+    ;
+  memmove(&g->vma[i+1], &g->vma[i], (g->nvma - i) * sizeof(struct vma));
+  g->nvma++;
+  v = &g->vma[i];
+  v->start = start;
+  v->end = end;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = 0;
+  v->off = 0;
+  v->ops = ops;
+  return v;
+}
+
+// Remove v from g's regions. Its pages and file are the
+// caller's to deal with.
+void
+vmaremove(struct proc *g, struct vma *v)
+{
+  int i = v - g->vma;
+
+  memmove(v, v + 1, (g->nvma - i - 1) * sizeof(struct vma));
+  g->nvma--;
+}
+
+// g's heap, whose end sbrk() moves, or 0 before exec().
+struct vma*
+vmaheap(struct proc *g)
+{
+  for(struct vma *v = g->vma; v < &g->vma[g->nvma]; v++)
+    if(v->ops == &heapops)
+      return v;
+  return 0;
+}
+
+// Grow the stack down to cover va, if the stack is the
+// region above it and nothing lies in between. Returns 0, or
+// -1 if it did not.
+int
+vmagrowdown(struct proc *g, uint64 va)
+{
+  struct vma *v = vmaabove(g, va);
+
+  va = PGROUNDDOWN(va);
+  if(v == 0 || v->ops != &stackops || v->start <= va)
+    return -1;
+  if(v > g->vma && (v-1)->end > va)
+    return -1;
+  v->start = va;
+  return 0;
+}
+
+// the page behind every heap page that has only been read.
+// it holds a reference of its own, so it is never freed.
+static char *zeropage;
+
+void
+vmainit(void)
+{
+  if((zeropage = kalloc()) == 0)
+    panic("vmainit");
+  memset(zeropage, 0, PGSIZE);
+}
+
+static int
+mapped(struct proc *g, uint64 va)
+{
+  pte_t *pte = walk(g->pagetable, va, 0);
+
+  return pte != 0 && (*pte & PTE_V);
+}
+
+// Give the pages of [a, b) that have none a page of zeroes,
+// from a up, until out of memory: zeropage, unless write,
+// which also gives those that have zeropage one of their own.
+static void
+zeromap(struct proc *g, uint64 a, uint64 b, int write)
+{
+  pte_t *pte;
+  char *mem;
+
+  for(uint64 va = a; va < b; va += PGSIZE){
+    if((pte = walk(g->pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+      if(write && PTE2PA(*pte) == (uint64)zeropage && uvmrealloc(g, va) != 0)
+        break;
+      continue;
+    }
+    if(!write){
+      if(map_onepage(g->pagetable, va, (uint64)zeropage, PTE_COW|PTE_X|PTE_R|PTE_U) != 0)
+        break;
+      inc_page_ref((uint64)zeropage, 1);
+      continue;
+    }
+    if((mem = kalloc()) == 0)
+      break;
+    memset(mem, 0, PGSIZE);
+    if(map_onepage(g->pagetable, va, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+      kfree(mem);
+      break;
+    }
+  }
+  tlbflush(g, a, (b - a) / PGSIZE);
+}
+
+static int
+codefault(struct proc *g, struct vma *v, uint64 va, int access)
+{
+  if(!cowpage(g, va))
+    return -1;
+  return uvmrealloc(g, PGROUNDDOWN(va));
+}
+
+// the heap and the stack: memory that is there to be used,
+// and gets a page when it first is.
+static int
+zerofault(struct proc *g, struct vma *v, uint64 va, int access)
+{
+  int write = access == PROT_WRITE;
+  pte_t *pte;
+  uint64 a, b;
+
+  // a write to zeropage maps the window around it, as a
+  // write to a page not there does; see zeromap().
+  pte = walk(g->pagetable, va, 0);
+  if(cowpage(g, va) && PTE2PA(*pte) != (uint64)zeropage)
+    return codefault(g, v, va, access);
+  // the stack is seldom read before it is written.
+  if(v->ops != &heapops)
+    write = 1;
+  else if(!write)
+    myproc()->ru.zeroflt++;
+  a = PGROUNDDOWN(va);
+  b = a + PGSIZE;
+  // the heap fills up, the stack down; the page just before
+  // on the way is there if the pages are touched in order.
+  if(a > v->start && mapped(g, a - PGSIZE))
+    b = a + FAULTAROUND * PGSIZE < v->end ? a + FAULTAROUND * PGSIZE : v->end;
+  else if(b < v->end && mapped(g, b))
+    a = b - FAULTAROUND * PGSIZE > v->start ? b - FAULTAROUND * PGSIZE : v->start;
+  // the faulting page first: the others only if there is
+  // memory to spare.
+  zeromap(g, PGROUNDDOWN(va), PGROUNDDOWN(va) + PGSIZE, write);
+  pte = walk(g->pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_W) == 0))
+    return -1;
+  zeromap(g, a, b, write);
+  return 0;
+}
+
+// Fill in the pages of [va, va+len) that are not there, as a
+// fault on each would, but without taking the faults.
+// Returns 0, or -1 if part of the range is in no region or
+// out of memory.
+int
+vmapopulate(struct proc *g, uint64 va, uint64 len)
+{
+  struct vma *v;
+  uint64 end = va + len, b;
+  int r = 0;
+
+  // no region reaches MAXVA, and past it PGROUNDUP(end)
+  // could wrap to 0.
+  if(end < va || end > MAXVA)
+    return -1;
+  for(va = PGROUNDDOWN(va); va < end && r == 0; va = b){
+    b = va + PGSIZE;
+    ACQUIRE(&g->vmlock);
+    if((v = vmafind(g, va)) == 0){
+      r = -1;
+    } else if(v->ops == &heapops || v->ops == &stackops){
+      // a batch of pages per hold of the lock.
+      b = va + FAULTAROUND * PGSIZE;
+      if(b > v->end)
+        b = v->end;
+      if(b > PGROUNDUP(end))
+        b = PGROUNDUP(end);
+      zeromap(g, va, b, 1);
+      if(!mapped(g, b - PGSIZE))
+        r = -1;
+    } else if(!mapped(g, va) && v->ops->fault(g, v, va, (v->prot & PROT_WRITE) ? PROT_WRITE : PROT_READ) < 0){
+      r = -1;
+    }
+    RELEASE(&g->vmlock);
+  }
+  return r;
+}
+
+struct vmaops codeops = { "code", codefault };
+struct vmaops heapops = { "heap", zerofault };
+struct vmaops stackops = { "stack", zerofault };
@@ -0,0 +1,170 @@
+//
+// coroutine tests and benchmark: thousands of coroutines
+// yielding, a channel ping-pong between two coroutines, and
+// the same ping-pong between two processes over pipes, to
+// compare switch costs. Then the coroutines run again on
+// several workers, to check that none is lost to stealing.
+//
+// usage: corotest [coroutines]
+//
+
+#include "common/types.h"
+#include "user/user.h"
+
+#define YIELDS 10
+#define ROUNDS 2000
+#define NWORKER 4
+
+int ncoro = 2000;
+int count;
+int failed;   // exit() in a coroutine would end only its worker
+
+static void
+yielder(void *arg)
+{
+  for(int i = 0; i < YIELDS; i++){
+    __atomic_fetch_add(&count, 1, __ATOMIC_RELAXED);
+    coro_yield();
+  }
+}
+
+static void
+pinger(void *arg)
+{
+  struct chan **ch = arg;
+
+  for(int i = 0; i < ROUNDS; i++){
+    chan_send(ch[0], i);
+    if(chan_recv(ch[1]) != i){
+      fprintf(2, "corotest: ping-pong out of order\n");
+      failed = 1;
+      return;
+    }
+  }
+}
+
+static void
+ponger(void *arg)
+{
+  struct chan **ch = arg;
+
+  for(int i = 0; i < ROUNDS; i++)
+    chan_send(ch[1], chan_recv(ch[0]));
+}
+
+struct chan *results;
+
+static void
+sender(void *arg)
+{
+  coro_yield();
+  chan_send(results, (uint64)arg);
+}
+
+static void
+collector(void *arg)
+{
+  uint64 sum = 0, want = 0;
+
+  for(int i = 0; i < ncoro; i++){
+    sum += chan_recv(results);
+    want += i;
+  }
+  if(sum != want){
+    fprintf(2, "corotest: sum %d, want %d\n", (int)sum, (int)want);
+    failed = 1;
+  }
+}
+
+// ns per round trip of one byte between two processes.
+static uint64
+piperoundtrip(void)
+{
+  int ping[2], pong[2];
+  char c = 'x';
+  uint64 start, elapsed;
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    fprintf(2, "corotest: pipe failed\n");
+    exit(1);
+  }
+  if(fork() == 0){
+    close(ping[1]);
+    close(pong[0]);
+    while(read(ping[0], &c, 1) == 1)
+      write(pong[1], &c, 1);
+    exit(0);
+  }
+  close(ping[0]);
+  close(pong[1]);
+  start = unanotime();
+  for(int i = 0; i < ROUNDS; i++)
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+      fprintf(2, "corotest: pipe round trip failed\n");
+      exit(1);
+    }
+  elapsed = unanotime() - start;
+  close(ping[1]);
+  close(pong[0]);
+  wait(0);
+  return elapsed / ROUNDS;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct chan *ch[2];
+  uint64 start, yieldns, channs, pipens;
+
+  if(argc > 2){
+    fprintf(2, "usage: corotest [coroutines]\n");
+    exit(1);
+  }
+  if(argc == 2 && (ncoro = atoi(argv[1])) <= 0){
+    fprintf(2, "corotest: bad coroutine count\n");
+    exit(1);
+  }
+
+  for(int i = 0; i < ncoro; i++){
+    if(coro_spawn(yielder, 0) < 0){
+      fprintf(2, "corotest: coro_spawn failed\n");
+      exit(1);
+    }
+  }
+  start = unanotime();
+  if(coro_run(1) < 0 || count != ncoro * YIELDS){
+    fprintf(2, "corotest: yield run failed, count %d\n", count);
+    exit(1);
+  }
+  yieldns = (unanotime() - start) / (ncoro * YIELDS);
+
+  ch[0] = chan_new(0);
+  ch[1] = chan_new(0);
+  coro_spawn(pinger, ch);
+  coro_spawn(ponger, ch);
+  start = unanotime();
+  if(coro_run(1) < 0 || failed){
+    fprintf(2, "corotest: ping-pong run failed\n");
+    exit(1);
+  }
+  channs = (unanotime() - start) / ROUNDS;
+  chan_free(ch[0]);
+  chan_free(ch[1]);
+
+  pipens = piperoundtrip();
+
+  results = chan_new(16);
+  for(int i = 0; i < ncoro; i++)
+    coro_spawn(sender, (void*)(uint64)i);
+  coro_spawn(collector, 0);
+  if(coro_run(NWORKER) < 0 || failed){
+    fprintf(2, "corotest: run on %d workers failed\n", NWORKER);
+    exit(1);
+  }
+  chan_free(results);
+
+  printf("corotest: %d coroutines, yield %d ns\n", ncoro, (int)yieldns);
+  printf("corotest: round trip: channel %d ns, pipe %d ns\n", (int)channs, (int)pipens);
+  printf("corotest: OK\n");
+  exit(0);
+}
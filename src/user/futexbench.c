@@ -0,0 +1,124 @@
+//
+// lock contention benchmark: threads add to one counter,
+// each addition under a lock, first a futex mutex and then
+// a spin lock that only yields the CPU by being preempted.
+// The threads start together, on a condition variable.
+//
+// usage: futexbench [threads [rounds]]
+//
+
+#include "common/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define MAXTHREAD 16
+
+struct mutex startlock;
+struct cond startcond;
+int started;
+
+struct mutex mutex;
+uint spin;
+int counter;
+int rounds = 10000;
+int usemutex;
+
+static void
+lock(void)
+{
+  if(usemutex)
+    mutex_lock(&mutex);
+  else
+    while(__atomic_exchange_n(&spin, 1, __ATOMIC_ACQUIRE) != 0)
+      ;
+}
+
+static void
+unlock(void)
+{
+  if(usemutex)
+    mutex_unlock(&mutex);
+  else
+    __atomic_store_n(&spin, 0, __ATOMIC_RELEASE);
+}
+
+static int
+worker(void *arg)
+{
+  mutex_lock(&startlock);
+  while(!started)
+    cond_wait(&startcond, &startlock);
+  mutex_unlock(&startlock);
+
+  for(int i = 0; i < rounds; i++){
+    lock();
+    counter++;
+    unlock();
+  }
+  return 0;
+}
+
+// Run nthread workers with the lock chosen by usemutex.
+// Returns the time taken in ns.
+static uint64
+run(int nthread, char *stacks)
+{
+  int tids[MAXTHREAD];
+  uint64 start;
+
+  counter = 0;
+  started = 0;
+  for(int i = 0; i < nthread; i++){
+    if((tids[i] = thread_create(worker, 0, stacks + i * PGSIZE, PGSIZE)) < 0){
+      fprintf(2, "futexbench: thread_create failed\n");
+      exit(1);
+    }
+  }
+  start = unanotime();
+  mutex_lock(&startlock);
+  started = 1;
+  cond_broadcast(&startcond);
+  mutex_unlock(&startlock);
+  for(int i = 0; i < nthread; i++)
+    join(tids[i], 0);
+  if(counter != nthread * rounds){
+    fprintf(2, "futexbench: counter %d, want %d\n", counter, nthread * rounds);
+    exit(1);
+  }
+  return unanotime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nthread = 4;
+  char *stacks;
+  uint64 t;
+
+  if(argc > 3){
+    fprintf(2, "usage: futexbench [threads [rounds]]\n");
+    exit(1);
+  }
+  if(argc > 1 && ((nthread = atoi(argv[1])) <= 0 || nthread > MAXTHREAD)){
+    fprintf(2, "futexbench: 1 to %d threads\n", MAXTHREAD);
+    exit(1);
+  }
+  if(argc > 2 && (rounds = atoi(argv[2])) <= 0){
+    fprintf(2, "futexbench: bad round count\n");
+    exit(1);
+  }
+  if((stacks = malloc(nthread * PGSIZE)) == 0){
+    fprintf(2, "futexbench: out of memory\n");
+    exit(1);
+  }
+
+  usemutex = 1;
+  t = run(nthread, stacks);
+  printf("futexbench: mutex, %d threads x %d: %d us, %d ns each\n",
+         nthread, rounds, (int)(t / 1000), (int)(t / (nthread * rounds)));
+  usemutex = 0;
+  t = run(nthread, stacks);
+  printf("futexbench: spin,  %d threads x %d: %d us, %d ns each\n",
+         nthread, rounds, (int)(t / 1000), (int)(t / (nthread * rounds)));
+  exit(0);
+}
@@ -74,6 +74,119 @@ sparse_memory_unmap(char *s)
   exit(0);
 }
 
+#define LINEAR_SZ (32 * 1024 * 1024)
+
+// touch LINEAR_SZ of new heap page by page in a child, having
+// populated it first with madvise() if populate is set, and
+// return the faults the child took; *ms is how long it took.
+int
+linear_faults(int populate, int *ms)
+{
+  struct rusage ru;
+  uint64 start;
+  char *p;
+  int pid, status;
+
+  start = unanotime();
+  if ((pid = fork()) < 0) {
+    printf("error forking\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    if ((p = sbrk(LINEAR_SZ)) == (char*)0xffffffffffffffffL) {
+      printf("sbrk() failed\n");
+      exit(1);
+    }
+    if (populate && madvise(p, -(uint64)p - 1, MADV_WILLNEED) != -1) {
+      printf("madvise() past the end of memory succeeded\n");
+      exit(1);
+    }
+    if (populate && madvise(p, LINEAR_SZ, MADV_WILLNEED) < 0) {
+      printf("madvise() failed\n");
+      exit(1);
+    }
+    for (char *i = p; i < p + LINEAR_SZ; i += PGSIZE)
+      *i = 1;
+    exit(0);
+  }
+  if (wait4(pid, &status, &ru) != pid || status != 0) {
+    printf("child failed\n");
+    exit(1);
+  }
+  *ms = (unanotime() - start) / 1000000;
+  return ru.minflt;
+}
+
+// pages touched in order fault a window at a time, and not
+// at all once populated.
+void
+linear_memory(char *s)
+{
+  int pages = LINEAR_SZ / PGSIZE;
+  int lazy, populated, lazyms, populatedms;
+
+  lazy = linear_faults(0, &lazyms);
+  populated = linear_faults(1, &populatedms);
+  printf("%d pages: %d faults in %d ms, populated %d faults in %d ms\n",
+         pages, lazy, lazyms, populated, populatedms);
+  if (lazy >= pages / 2) {
+    printf("no fault-around\n");
+    exit(1);
+  }
+  if (populated >= lazy) {
+    printf("populated memory still faults\n");
+    exit(1);
+  }
+  exit(0);
+}
+
+// reads of untouched heap see zeroes from the shared zero
+// page, and a write after them still gets a page of its own.
+void
+zero_page(char *s)
+{
+  struct rusage ru;
+  char *p;
+  int pid, status;
+
+  if ((pid = fork()) < 0) {
+    printf("error forking\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    if ((p = sbrk(LINEAR_SZ)) == (char*)0xffffffffffffffffL) {
+      printf("sbrk() failed\n");
+      exit(1);
+    }
+    for (char *i = p; i < p + LINEAR_SZ; i += 64 * PGSIZE) {
+      if (*i != 0) {
+        printf("untouched memory not zero\n");
+        exit(1);
+      }
+    }
+    for (char *i = p; i < p + LINEAR_SZ; i += 64 * PGSIZE)
+      *i = 1;
+    for (char *i = p; i < p + LINEAR_SZ; i += PGSIZE) {
+      if (*i != ((i - p) % (64 * PGSIZE) == 0)) {
+        printf("write showed through the zero page\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  if (wait4(pid, &status, &ru) != pid || status != 0) {
+    printf("child failed\n");
+    exit(1);
+  }
+  printf("%d pages: %d faults, %d from the zero page, %d cow\n",
+         LINEAR_SZ / PGSIZE, ru.minflt, ru.zeroflt, ru.cowflt);
+  if (ru.zeroflt == 0) {
+    printf("no zero page faults\n");
+    exit(1);
+  }
+  exit(0);
+}
+
 void
 oom(char *s)
 {
@@ -133,6 +246,8 @@ main(int argc, char *argv[])
   } tests[] = {
     { sparse_memory, "lazy alloc"},
     { sparse_memory_unmap, "lazy unmap"},
+    { linear_memory, "lazy linear"},
+    { zero_page, "zero page"},
     { oom, "out of memory"},
     { 0, 0},
   };
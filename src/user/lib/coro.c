@@ -0,0 +1,390 @@
+#include "common/types.h"
+#include "user/user.h"
+
+// Coroutines: green threads scheduled in user space.
+//
+// coro_run() runs the coroutines on one or more workers, each
+// a kernel thread from thread_create() (the first is the
+// caller itself). A worker keeps a queue of the coroutines
+// ready to run, and switches to each in turn with
+// coro_swtch() in coroswtch.S. A coroutine runs until it
+// yields, blocks on a channel, or returns, and then switches
+// back to its worker, which does whatever must wait until
+// the coroutine is off its stack: queue it again, release
+// the channel lock it blocked under, or free it. A worker
+// whose queue is empty steals from the others.
+//
+// The tp register of a worker's kernel thread points to the
+// worker, so a coroutine finds the one it runs on from there.
+
+#define MAXWORKER 8
+#define CORO_STACK 4096
+#define WORKER_STACK (4 * 4096)
+
+struct coro_context {
+  uint64 ra;
+  uint64 sp;
+  uint64 s[12];
+};
+
+enum corostate { RUNNABLE, RUNNING, YIELDED, BLOCKED, DEAD };
+
+struct coro {
+  struct coro_context context;
+  enum corostate state;
+  struct coro *next;        // on a run queue or a channel
+  struct mutex *unlock;     // to release once BLOCKED
+  void (*fn)(void*);
+  void *arg;
+  uint64 val;               // passed through a channel
+};
+
+struct worker {
+  struct coro_context context;  // coro_swtch() here to get back
+  struct mutex lock;            // guards the queue
+  struct coro *head;
+  struct coro *tail;
+  int n;
+  struct coro *cur;             // running now
+};
+
+struct chan {
+  struct mutex lock;
+  uint64 *buf;
+  int cap;
+  int n;                    // values in buf
+  int first;                // the oldest of them
+  struct coro *senders;     // blocked, with the value in val
+  struct coro *receivers;   // blocked, waiting for val
+};
+
+void coro_swtch(struct coro_context*, struct coro_context*);
+
+static struct worker workers[MAXWORKER];
+static int nworker;
+static int running;             // in coro_run()
+static int live;                // coroutines not yet DEAD
+static int blocked;             // and of those, BLOCKED
+static struct mutex alloclock;  // malloc() is not thread-safe
+
+static struct worker*
+myworker(void)
+{
+  struct worker *w;
+
+  if(!running)
+    return &workers[0];
+  asm volatile("mv %0, tp" : "=r" (w));
+  return w;
+}
+
+static void*
+coro_malloc(uint n)
+{
+  void *p;
+
+  mutex_lock(&alloclock);
+  p = malloc(n);
+  mutex_unlock(&alloclock);
+  return p;
+}
+
+static void
+coro_free(void *p)
+{
+  mutex_lock(&alloclock);
+  free(p);
+  mutex_unlock(&alloclock);
+}
+
+static void
+push(struct worker *w, struct coro *c)
+{
+  mutex_lock(&w->lock);
+  c->next = 0;
+  if(w->tail)
+    w->tail->next = c;
+  else
+    w->head = c;
+  w->tail = c;
+  w->n++;
+  mutex_unlock(&w->lock);
+}
+
+static struct coro*
+pop(struct worker *w)
+{
+  struct coro *c;
+
+  if(w->n == 0)
+    return 0;
+  mutex_lock(&w->lock);
+  if((c = w->head) != 0){
+    if((w->head = c->next) == 0)
+      w->tail = 0;
+    w->n--;
+  }
+  mutex_unlock(&w->lock);
+  return c;
+}
+
+// Take a coroutine from the worker with the longest queue.
+// The lengths are read unlocked, so this may find nothing.
+static struct coro*
+steal(struct worker *w)
+{
+  struct worker *victim = 0;
+  int max = 0;
+
+  for(int i = 0; i < nworker; i++){
+    if(&workers[i] != w && workers[i].n > max){
+      max = workers[i].n;
+      victim = &workers[i];
+    }
+  }
+  return victim ? pop(victim) : 0;
+}
+
+// Make c runnable again, on this worker.
+static void
+ready(struct coro *c)
+{
+  c->state = RUNNABLE;
+  __atomic_fetch_sub(&blocked, 1, __ATOMIC_RELAXED);
+  push(myworker(), c);
+}
+
+// Switch from the running coroutine back to its worker.
+static void
+coro_sched(void)
+{
+  struct worker *w = myworker();
+
+  coro_swtch(&w->cur->context, &w->context);
+}
+
+// Where a new coroutine starts.
+static void
+coro_start(void)
+{
+  struct coro *c = myworker()->cur;
+
+  c->fn(c->arg);
+  coro_exit();
+}
+
+// Start fn(arg) in a new coroutine. Returns 0, or -1 if out
+// of memory.
+int
+coro_spawn(void (*fn)(void*), void *arg)
+{
+  struct coro *c;
+  char *stack;
+
+  if((c = coro_malloc(sizeof(*c) + CORO_STACK)) == 0)
+    return -1;
+  stack = (char*)(c + 1);
+  memset(&c->context, 0, sizeof(c->context));
+  c->context.ra = (uint64)coro_start;
+  c->context.sp = ((uint64)stack + CORO_STACK) & ~15;
+  c->fn = fn;
+  c->arg = arg;
+  c->unlock = 0;
+  c->state = RUNNABLE;
+  __atomic_fetch_add(&live, 1, __ATOMIC_RELAXED);
+  push(myworker(), c);
+  return 0;
+}
+
+// Let the other coroutines run.
+void
+coro_yield(void)
+{
+  myworker()->cur->state = YIELDED;
+  coro_sched();
+}
+
+// End the running coroutine. Returning from its function
+// does the same.
+void
+coro_exit(void)
+{
+  myworker()->cur->state = DEAD;
+  coro_sched();
+  for(;;)
+    ;   // not reached
+}
+
+// Block the running coroutine until ready(); its worker
+// releases lk once it is off the coroutine's stack.
+static void
+park(struct mutex *lk)
+{
+  struct coro *c = myworker()->cur;
+
+  c->state = BLOCKED;
+  c->unlock = lk;
+  coro_sched();
+}
+
+static int
+worker_main(void *arg)
+{
+  struct worker *w = arg;
+  struct coro *c;
+
+  asm volatile("mv tp, %0" : : "r" (w));
+  for(;;){
+    if((c = pop(w)) == 0 && (c = steal(w)) == 0){
+      // everything left is blocked when no coroutine runs
+      // to wake the blocked ones.
+      if(__atomic_load_n(&live, __ATOMIC_RELAXED) ==
+         __atomic_load_n(&blocked, __ATOMIC_RELAXED))
+        return 0;
+      nanosleep(10000);
+      continue;
+    }
+    w->cur = c;
+    c->state = RUNNING;
+    coro_swtch(&w->context, &c->context);
+    w->cur = 0;
+    switch(c->state){
+    case YIELDED:
+      c->state = RUNNABLE;
+      push(w, c);
+      break;
+    case BLOCKED:
+      __atomic_fetch_add(&blocked, 1, __ATOMIC_RELAXED);
+      if(c->unlock)
+        mutex_unlock(c->unlock);
+      break;
+    case DEAD:
+      coro_free(c);
+      __atomic_fetch_sub(&live, 1, __ATOMIC_RELAXED);
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+// Run the coroutines spawned so far, and those they spawn,
+// on n workers. Returns 0 once all have ended, or -1 if
+// those left are all blocked, or if a worker cannot start.
+int
+coro_run(int n)
+{
+  int tids[MAXWORKER];
+  char *stacks;
+
+  if(n < 1 || n > MAXWORKER || (stacks = malloc((n - 1) * WORKER_STACK + 1)) == 0)
+    return -1;
+  nworker = n;
+  running = 1;
+  for(int i = 1; i < n; i++){
+    tids[i] = thread_create(worker_main, &workers[i], stacks + (i - 1) * WORKER_STACK, WORKER_STACK);
+    if(tids[i] < 0){
+      nworker = i;
+      break;
+    }
+  }
+  worker_main(&workers[0]);
+  for(int i = 1; i < nworker; i++)
+    join(tids[i], 0);
+  running = 0;
+  free(stacks);
+  if(live != 0 || nworker < n)
+    return -1;
+  return 0;
+}
+
+// A channel of uint64 values that holds up to cap of them
+// before a sender blocks; with cap 0, a send waits for the
+// receive.
+struct chan*
+chan_new(int cap)
+{
+  struct chan *ch;
+
+  if(cap < 0 || (ch = coro_malloc(sizeof(*ch) + cap * sizeof(uint64))) == 0)
+    return 0;
+  memset(ch, 0, sizeof(*ch));
+  ch->buf = (uint64*)(ch + 1);
+  ch->cap = cap;
+  return ch;
+}
+
+void
+chan_free(struct chan *ch)
+{
+  coro_free(ch);
+}
+
+static void
+enqueue(struct coro **q, struct coro *c)
+{
+  c->next = 0;
+  while(*q)
+    q = &(*q)->next;
+  *q = c;
+}
+
+static struct coro*
+dequeue(struct coro **q)
+{
+  struct coro *c = *q;
+
+  if(c)
+    *q = c->next;
+  return c;
+}
+
+void
+chan_send(struct chan *ch, uint64 v)
+{
+  struct coro *c;
+
+  mutex_lock(&ch->lock);
+  if((c = dequeue(&ch->receivers)) != 0){
+    c->val = v;
+    ready(c);
+  } else if(ch->n < ch->cap){
+    ch->buf[(ch->first + ch->n++) % ch->cap] = v;
+  } else {
+    c = myworker()->cur;
+    c->val = v;
+    enqueue(&ch->senders, c);
+    park(&ch->lock);   // the receiver takes val
+    return;
+  }
+  mutex_unlock(&ch->lock);
+}
+
+uint64
+chan_recv(struct chan *ch)
+{
+  struct coro *c;
+  uint64 v;
+
+  mutex_lock(&ch->lock);
+  if(ch->n > 0){
+    v = ch->buf[ch->first];
+    ch->first = (ch->first + 1) % ch->cap;
+    ch->n--;
+    // room now for a blocked sender's value.
+    if((c = dequeue(&ch->senders)) != 0){
+      ch->buf[(ch->first + ch->n++) % ch->cap] = c->val;
+      ready(c);
+    }
+  } else if((c = dequeue(&ch->senders)) != 0){
+    v = c->val;
+    ready(c);
+  } else {
+    c = myworker()->cur;
+    enqueue(&ch->receivers, c);
+    park(&ch->lock);   // the sender fills in val
+    return c->val;
+  }
+  mutex_unlock(&ch->lock);
+  return v;
+}
@@ -0,0 +1,69 @@
+#include "common/types.h"
+#include "user/user.h"
+
+// Mutexes and condition variables on futexes.
+//
+// A mutex is 0 when free, 1 when held, and 2 when held and
+// someone may be waiting for it, so that the holder only
+// makes a futex_wake() system call when that is needed.
+
+static void
+mutex_lock_contended(struct mutex *m)
+{
+  // whoever we take it from may have had waiters.
+  while(__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0)
+    futex_wait(&m->state, 2);
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  uint c = 0;
+
+  if(!__atomic_compare_exchange_n(&m->state, &c, 1, 0,
+                                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    mutex_lock_contended(m);
+}
+
+// Returns 1 if m was taken, 0 if it is held.
+int
+mutex_trylock(struct mutex *m)
+{
+  uint c = 0;
+
+  return __atomic_compare_exchange_n(&m->state, &c, 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2)
+    futex_wake(&m->state, 1);
+}
+
+// A condition variable counts the signals; a waiter sleeps
+// only as long as no signal has come since it let go of m.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  uint seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  mutex_lock_contended(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+  futex_wake(&c->seq, 0x7fffffff);
+}
@@ -54,6 +54,87 @@ getcwd(char *buf, int size)
   return strncpy(buf, u->cwd, MAXPATH);
 }
 
+// the hart this process last started running on.
+int
+ugethart(void)
+{
+  struct usyscall *u = (struct usyscall *)USYSCALL;
+  return u->hart;
+}
+
+// uptime(), read from the vdso page.
+uint
+uuptime(void)
+{
+  volatile struct vdso *v = (struct vdso *)VDSO;
+  uint seq, t;
+
+  do {
+    while((seq = v->seq) & 1)
+      ;
+    __sync_synchronize();
+    t = v->ticks;
+    __sync_synchronize();
+  } while(v->seq != seq);
+  return t;
+}
+
+// nanoseconds since boot, from the time CSR.
+uint64
+unanotime(void)
+{
+  struct vdso *v = (struct vdso *)VDSO;
+  uint64 t;
+
+  asm volatile("rdtime %0" : "=r" (t));
+  return t * (1000000000 / v->timebase);
+}
+
+// load average in units of 1/LOADSCALE, from the vdso page.
+uint
+uloadavg(void)
+{
+  volatile struct vdso *v = (struct vdso *)VDSO;
+  uint seq, l;
+
+  do {
+    while((seq = v->seq) & 1)
+      ;
+    __sync_synchronize();
+    l = v->loadavg;
+    __sync_synchronize();
+  } while(v->seq != seq);
+  return l;
+}
+
+// what a thread from thread_create() starts with, at the
+// top of its stack.
+struct thread_start {
+  int (*fn)(void*);
+  void *arg;
+};
+
+static void
+thread_entry(void *arg)
+{
+  struct thread_start *ts = arg;
+  exit(ts->fn(ts->arg));
+}
+
+// Run fn(arg) in a new thread on the size bytes at stack.
+// The thread exits with what fn returns.
+// Returns its id, for join(), or -1.
+int
+thread_create(int (*fn)(void*), void *arg, void *stack, int size)
+{
+  struct thread_start *ts;
+
+  ts = (struct thread_start*)(((uint64)stack + size - sizeof(*ts)) & ~15);
+  ts->fn = fn;
+  ts->arg = arg;
+  return clone(thread_entry, ts, ts);
+}
+
 // rm everything, using unlink
 static int
 rmdir_(char *path)
@@ -0,0 +1,64 @@
+//
+// pipe ping-pong benchmark: parent and child bounce one
+// byte back and forth over two pipes, so every round trip
+// is two wakeups and two context switches.
+//
+// usage: pingpong [rounds]
+//
+
+#include "common/types.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = 10000;
+  int ping[2], pong[2];
+  char c = 'x';
+  int pid;
+  uint64 start, elapsed;
+
+  if(argc > 2){
+    fprintf(2, "usage: pingpong [rounds]\n");
+    exit(1);
+  }
+  if(argc == 2 && (rounds = atoi(argv[1])) <= 0){
+    fprintf(2, "pingpong: bad round count\n");
+    exit(1);
+  }
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    fprintf(2, "pingpong: pipe failed\n");
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "pingpong: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(ping[1]);
+    close(pong[0]);
+    while(read(ping[0], &c, 1) == 1)
+      write(pong[1], &c, 1);
+    exit(0);
+  }
+
+  close(ping[0]);
+  close(pong[1]);
+  start = unanotime();
+  for(int i = 0; i < rounds; i++){
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+      fprintf(2, "pingpong: round %d failed\n", i);
+      exit(1);
+    }
+  }
+  elapsed = unanotime() - start;
+  close(ping[1]);
+  wait(0);
+
+  printf("pingpong: %d round trips in %d us, %d ns each\n",
+         rounds, (int)(elapsed / 1000), (int)(elapsed / rounds));
+  exit(0);
+}
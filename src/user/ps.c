@@ -0,0 +1,40 @@
+//
+// list processes with their scheduling level.
+// with a pid and a level, set that process's nice level.
+//
+// usage: ps [pid level]
+//
+
+#include "common/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+struct procinfo procs[NPROC];
+
+int
+main(int argc, char *argv[])
+{
+  int n;
+
+  if(argc != 1 && argc != 3){
+    fprintf(2, "usage: ps [pid level]\n");
+    exit(1);
+  }
+  if(argc == 3){
+    if(setpriority(atoi(argv[1]), atoi(argv[2])) < 0){
+      fprintf(2, "ps: cannot set level of %s\n", argv[1]);
+      exit(1);
+    }
+    exit(0);
+  }
+
+  if((n = getprocs(procs, NPROC)) < 0){
+    fprintf(2, "ps: getprocs failed\n");
+    exit(1);
+  }
+  printf("pid\tstate   level  nice  name\n");
+  for(int i = 0; i < n; i++)
+    printf("%d\t%s  %d      %d     %s\n",
+           procs[i].pid, procs[i].state, procs[i].prio, procs[i].nice, procs[i].name);
+  exit(0);
+}
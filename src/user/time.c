@@ -0,0 +1,47 @@
+//
+// run a command and report the time it took and what it
+// used, from the rusage that wait4() returns for it.
+//
+// usage: time command [args...]
+//
+
+#include "common/types.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct rusage ru;
+  uint64 start, real;
+  int pid, status;
+
+  if(argc < 2){
+    fprintf(2, "usage: time command [args...]\n");
+    exit(1);
+  }
+
+  start = unanotime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "time: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv + 1);
+    fprintf(2, "time: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  if(wait4(pid, &status, &ru) != pid){
+    fprintf(2, "time: wait4 failed\n");
+    exit(1);
+  }
+  real = unanotime() - start;
+
+  printf("real %d ms, user %d ms, sys %d ms\n",
+         (int)(real / 1000000), (int)(ru.utime / 1000), (int)(ru.stime / 1000));
+  printf("faults: %d minor (%d zero page), %d cow\n", ru.minflt, ru.zeroflt, ru.cowflt);
+  printf("switches: %d voluntary, %d involuntary\n", ru.nvcsw, ru.nivcsw);
+  printf("io: %d bytes read, %d written, %d blocks in, %d out\n",
+         (int)ru.rchar, (int)ru.wchar, ru.inblock, ru.oublock);
+  exit(status);
+}
@@ -29,7 +29,7 @@ main(int argc, char *argv[])
       for (int i = 1; i < sizeof(sys_map)/sizeof(char*); i++) {
         if (strcmp(sys_map[i], token) == 0) {
           printf("%s ", token);
-          para |= (1 << i);
+          para |= (1L << i);
         }
       }
       token = strtok(NULL, "-");
@@ -2019,13 +2019,16 @@ dirfile(char *s)
 }
 
 // test that iput() is called at the end of _namei().
-// also tests empty file names.
+// also tests empty file names. goes deeper than the 50
+// in-memory inodes the kernel once had a fixed table of.
+#define NIREF 51
+
 void
 iref(char *s)
 {
   int i, fd;
 
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < NIREF; i++){
     if(mkdir("irefd") != 0){
       LOG("%s: mkdir irefd failed\n", s);
       exit(1);
@@ -2047,7 +2050,7 @@ iref(char *s)
   }
 
   // clean up
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < NIREF; i++){
     chdir("..");
     unlink("irefd");
   }
@@ -2692,6 +2695,204 @@ pgaccesstest()
   free(buf);
 }
 
+// sub-tick sleeps must not be rounded up to whole ticks.
+void
+nanosleeptest()
+{
+  int start = uptime();
+  for (int i = 0; i < 50; i++) {
+    if (nanosleep(1000000) < 0) {  // 1 ms
+      LOG("nanosleep failed\n");
+      exit(1);
+    }
+  }
+  if (uptime() - start > 10) {
+    LOG("50 x 1ms took %d ticks\n", uptime() - start);
+    exit(1);
+  }
+}
+
+#define NTHREAD 4
+static volatile int threadsum[NTHREAD];
+
+static int
+threadfn(void *arg)
+{
+  int i = (int)(uint64)arg;
+  // each thread grows the shared heap and writes to it.
+  char *p = sbrk(PGSIZE);
+  if (p == (char*)-1)
+    return -1;
+  p[0] = i;
+  for (int j = 0; j <= 1000; j++)
+    threadsum[i] += j;
+  return 100 + i;
+}
+
+// threads share memory, and join() hands back their status.
+void
+threadtest()
+{
+  int tids[NTHREAD], status;
+  char *stacks = malloc(NTHREAD * PGSIZE);
+
+  for (int i = 0; i < NTHREAD; i++) {
+    tids[i] = thread_create(threadfn, (void*)(uint64)i, stacks + i * PGSIZE, PGSIZE);
+    if (tids[i] < 0) {
+      LOG("thread_create failed\n");
+      exit(1);
+    }
+  }
+  for (int i = 0; i < NTHREAD; i++) {
+    if (join(tids[i], &status) != tids[i] || status != 100 + i) {
+      LOG("join %d failed, status %d\n", tids[i], status);
+      exit(1);
+    }
+    if (threadsum[i] != 500500) {
+      LOG("thread %d sum %d\n", i, threadsum[i]);
+      exit(1);
+    }
+  }
+  if (join(tids[0], 0) != -1) {
+    LOG("joined a thread twice\n");
+    exit(1);
+  }
+  free(stacks);
+}
+
+#define MMAPSZ (2 * PGSIZE + 100)
+
+// private and shared file mappings, and an anonymous one
+// shared with a child.
+void
+mmaptest()
+{
+  int fd, pid, status;
+  char *p;
+
+  if ((fd = open("mmapfile", O_CREATE | O_RDWR)) < 0) {
+    LOG("open failed\n");
+    exit(1);
+  }
+  for (int i = 0; i < MMAPSZ; i++) {
+    char c = 'a' + i % 26;
+    if (write(fd, &c, 1) != 1) {
+      LOG("write failed\n");
+      exit(1);
+    }
+  }
+
+  // a private mapping sees the file; what is written to it
+  // does not reach the file.
+  p = mmap(0, MMAPSZ, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED) {
+    LOG("mmap private failed\n");
+    exit(1);
+  }
+  for (int i = 0; i < MMAPSZ; i++) {
+    if (p[i] != 'a' + i % 26) {
+      LOG("private mapping byte %d is %d\n", i, p[i]);
+      exit(1);
+    }
+  }
+  // and nothing past the end of the file.
+  if (p[MMAPSZ] != 0) {
+    LOG("private mapping not zero past the end\n");
+    exit(1);
+  }
+  p[0] = 'X';
+  if (munmap(p, MMAPSZ) < 0) {
+    LOG("munmap private failed\n");
+    exit(1);
+  }
+
+  // a shared one is written back on munmap, half at a time.
+  p = mmap(0, MMAPSZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    LOG("mmap shared failed\n");
+    exit(1);
+  }
+  p[0] = 'Y';
+  p[2 * PGSIZE] = 'Z';
+  if (munmap(p, PGSIZE) < 0 || munmap(p + PGSIZE, MMAPSZ - PGSIZE) < 0) {
+    LOG("munmap shared failed\n");
+    exit(1);
+  }
+  if (munmap(p, PGSIZE) != -1) {
+    LOG("munmap of nothing succeeded\n");
+    exit(1);
+  }
+  close(fd);
+  if ((fd = open("mmapfile", O_RDONLY)) < 0 || read(fd, buf, MMAPSZ) != MMAPSZ) {
+    LOG("reread failed\n");
+    exit(1);
+  }
+  close(fd);
+  if (buf[0] != 'Y' || buf[2 * PGSIZE] != 'Z' || buf[1] != 'b') {
+    LOG("file has %c %c %c\n", buf[0], buf[2 * PGSIZE], buf[1]);
+    exit(1);
+  }
+  unlink("mmapfile");
+
+  // the kernel does not write to a read-only mapping for
+  // read(), and fails it instead.
+  if ((fd = open("README", O_RDONLY)) < 0) {
+    LOG("open README failed\n");
+    exit(1);
+  }
+  p = mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED || read(fd, p, 10) != -1) {
+    LOG("read into a read-only mapping succeeded\n");
+    exit(1);
+  }
+  close(fd);
+  munmap(p, PGSIZE);
+
+  // the first touch of an executable mapping can be a jump
+  // into it: a "ret" instruction.
+  uint32 ret = 0x00008067;
+  if ((fd = open("mmapfile", O_CREATE | O_RDWR)) < 0 || write(fd, &ret, sizeof(ret)) != sizeof(ret)) {
+    LOG("write mmapfile failed\n");
+    exit(1);
+  }
+  p = mmap(0, PGSIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED) {
+    LOG("mmap exec failed\n");
+    exit(1);
+  }
+  asm volatile("fence.i");
+  ((void (*)(void))p)();
+  munmap(p, PGSIZE);
+  close(fd);
+  unlink("mmapfile");
+
+  // fork() shares the pages of a shared anonymous mapping.
+  p = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    LOG("mmap anonymous failed\n");
+    exit(1);
+  }
+  if ((pid = fork()) < 0) {
+    LOG("fork failed\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    p[10] = 42;
+    exit(0);
+  }
+  wait(&status);
+  if (status != 0 || p[10] != 42) {
+    LOG("child's write not seen, %d\n", p[10]);
+    exit(1);
+  }
+  // a length that wraps around the end of memory.
+  if (munmap(p, -(uint64)p) != -1 || p[10] != 42) {
+    LOG("munmap to the end of memory succeeded\n");
+    exit(1);
+  }
+  munmap(p, PGSIZE);
+}
+
 // test the exec() code that cleans up if it runs out
 // of memory. it's really a test that such a condition
 // doesn't cause a panic.
@@ -3212,6 +3413,9 @@ main(int argc, char *argv[])
     {forktest, "forktest"},
     {ugetpidtest, "ugetpid"}, 
     {pgaccesstest, "pgaccess"}, 
+    {nanosleeptest, "nanosleep"},
+    {threadtest, "thread"},
+    {mmaptest, "mmap"},
     {recursion, "recursion"},
     {stackoverflow, "stackoverflow"},
     {cpmvtest, "cpmvtest"},
@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/(BLOCK_SIZE*8) + 1;
 int ninodeblocks = NINODES / INODES_PER_BLOCK + 1;
-int nlog = LOGSIZE;
+int nlog = LOGSIZE + 1; // log header + LOGSIZE blocks
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int ndata;  // Number of data blocks
 
@@ -193,6 +193,12 @@ main(int argc, char *argv[])
   winode(root_inode_no, &din);
 
   bitmap_alloc(freeblock);
+
+  // now that every block is placed, record the free count
+  sb.nfree = xint(FSSIZE - freeblock);
+  memset(buf, 0, sizeof(buf));
+  memmove(buf, &sb, sizeof(sb));
+  write_block(1, buf);
   exit(0);
 }
 